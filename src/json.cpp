@@ -1,4 +1,36 @@
 #include "json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+auto& json_node(json& value);
+auto& json_node(const json& value);
 
 struct json::impl {
 	enum json_type {
@@ -8,22 +40,379 @@ struct json::impl {
 		JSON_STR,
 		JSON_LIST,
 		JSON_DICT
-	} type;
-
-	double n;
-	bool b;
-	std::string s;
+	};
 
+	// Pairs of a dictionary, in insertion order. The keys of a document are kept in its arena,
+	// interned when it was parsed so that its dictionaries share them, while other pairs own theirs
 	struct list {
-		std::pair<std::string, json> value;
+		const std::string* key;
+		json value;
 		list *next;
 	};
-	list* head;
-	list* tail;
 
-	impl() : type(JSON_NULL), s(), head(nullptr), tail(nullptr) {}
+	struct owned_list : list {
+		std::string name;
+	};
+
+	static std::string_view name_of(const list* node) {
+		return *node->key;
+	}
+
+	static std::string_view name_of(const std::string* key) {
+		return *key;
+	}
+
+	// Hash table of named entries, with linear probing over a power of two
+	// number of slots, which is never more than half full
+	template <typename T>
+	struct hash_table {
+		struct slot {
+			size_t hash;
+			T* entry;
+		};
+		std::vector<slot> slots;
+		size_t count = 0;
+
+		static size_t hash_of(std::string_view key) {
+			return std::hash<std::string_view>{}(key);
+		}
+
+		T* find(std::string_view key, size_t hash) const {
+			if (slots.empty()) {
+				return nullptr;
+			}
+
+			size_t mask = slots.size() - 1;
+			for (size_t i = hash & mask; slots[i].entry != nullptr; i = (i + 1) & mask) {
+				if (slots[i].hash == hash && name_of(slots[i].entry) == key) {
+					return slots[i].entry;
+				}
+			}
+			return nullptr;
+		}
+
+		// Keeps the entry already there when the name is taken
+		void insert(T* entry, size_t hash) {
+			if (2 * (count + 1) > slots.size()) {
+				rehash(std::max<size_t>(64, 2 * slots.size()));
+			}
+
+			size_t mask = slots.size() - 1;
+			size_t i = hash & mask;
+			for (; slots[i].entry != nullptr; i = (i + 1) & mask) {
+				if (slots[i].hash == hash && name_of(slots[i].entry) == name_of(entry)) {
+					return;
+				}
+			}
+			slots[i] = slot{hash, entry};
+			count++;
+		}
+
+		void rehash(size_t capacity) {
+			std::vector<slot> previous(capacity, slot{0, nullptr});
+			previous.swap(slots);
+
+			size_t mask = slots.size() - 1;
+			for (const slot& moved : previous) {
+				if (moved.entry != nullptr) {
+					size_t i = moved.hash & mask;
+					while (slots[i].entry != nullptr) {
+						i = (i + 1) & mask;
+					}
+					slots[i] = moved;
+				}
+			}
+		}
+	};
+
+	// Index of the pairs of a large dictionary, by the first occurrence of each key,
+	// which is kept up to date from the moment the dictionary grows past INDEX_THRESHOLD
+	using key_index = hash_table<list>;
+	static constexpr size_t INDEX_THRESHOLD = 16;
+
+	// Contents of a string, a list or a dictionary, which copies share until one of them
+	// changes and gets its own. Once references into them are handed out, they are leaked
+	// and never shared again, since they may change at any time
+	struct shared {
+		std::atomic<uint32_t> refs{1};
+		bool leaked = false;
+	};
+
+	struct text : shared {
+		std::string value;
+	};
+
+	// Elements of a list, stored contiguously
+	struct elements : shared {
+		json* items = nullptr;
+		size_t size = 0;
+		size_t capacity = 0;
+	};
+
+	struct pairs : shared {
+		list* head = nullptr;
+		list* tail = nullptr;
+		size_t size = 0;
+		key_index* index = nullptr;
+
+		~pairs() {
+			delete index;
+		}
+	};
+
+	// Bump allocator holding every node of a parsed document, so that they are
+	// allocated next to each other and freed together with one linear sweep.
+	// It is released by the last heap node referring to it. Most documents are
+	// small, so chunks start at a fraction of their full size and double up to it
+	struct alignas(16) arena {
+		static constexpr size_t CHUNK = 1 << 16;
+		static constexpr size_t FIRST_CHUNK = CHUNK / 64;
+
+		template <typename T>
+		struct slab {
+			static constexpr size_t COUNT = CHUNK / sizeof(T);
+			static constexpr size_t FIRST_COUNT = FIRST_CHUNK / sizeof(T);
+
+			std::vector<T*> chunks;
+			size_t used = 0;
+			size_t capacity = 0;
+			size_t bytes = 0;
+
+			T* allocate() {
+				if (used == capacity) {
+					capacity = chunks.empty() ? FIRST_COUNT : std::min(2 * capacity, COUNT);
+					chunks.push_back((T*) ::operator new(capacity * sizeof(T)));
+					bytes += capacity * sizeof(T);
+					used = 0;
+				}
+				return chunks.back() + used++;
+			}
+
+			~slab() {
+				size_t count = FIRST_COUNT;
+				for (size_t i = 0; i < chunks.size(); i++) {
+					size_t constructed = i + 1 < chunks.size() ? count : used;
+					for (size_t j = 0; j < constructed; j++) {
+						chunks[i][j].~T();
+					}
+					::operator delete(chunks[i]);
+					count = std::min(2 * count, COUNT);
+				}
+			}
+		};
+
+		std::atomic<size_t> refs{1};
+
+		// Heap node of the document, the only one outside of the arena that may add to it
+		const impl* root = nullptr;
+
+		// Whether the keys of the document are interned, each one kept only once
+		bool interning = false;
+
+		// Raw memory for the arrays of the lists, whose elements need no destruction
+		// since they only point to impls of this arena
+		std::vector<char*> blocks;
+		char* block_ptr = nullptr;
+		char* block_end = nullptr;
+		size_t block_size = FIRST_CHUNK / 2;
+		size_t block_bytes = 0;
+
+		// Declared in this order to be destroyed from the last one, since the json
+		// destructors look at the impls and the impls look at their contents
+		slab<std::string> strings;
+		hash_table<const std::string> keys;
+		slab<text> texts;
+		slab<elements> lists;
+		slab<pairs> dicts;
+		slab<impl> impls;
+		slab<list> nodes;
+
+		void* allocate(size_t bytes) {
+			bytes = (bytes + alignof(json) - 1) & ~(alignof(json) - 1);
+			if (bytes > CHUNK / 4) {
+				blocks.push_back((char*) ::operator new(bytes));
+				block_bytes += bytes;
+				return blocks.back();
+			}
+
+			if ((size_t) (block_end - block_ptr) < bytes) {
+				do {
+					block_size = std::min(2 * block_size, CHUNK);
+				} while (block_size < bytes);
+				blocks.push_back((char*) ::operator new(block_size));
+				block_bytes += block_size;
+				block_ptr = blocks.back();
+				block_end = block_ptr + block_size;
+			}
+			void* ptr = block_ptr;
+			block_ptr += bytes;
+			return ptr;
+		}
+
+		~arena() {
+			for (char* block : blocks) {
+				::operator delete(block);
+			}
+		}
+
+		// Copy of key, which lives as long as the arena and is shared by all of its
+		// dictionaries when their keys are interned
+		const std::string* keep(std::string_view key) {
+			if (!interning) {
+				return new (strings.allocate()) std::string(key);
+			}
+
+			size_t hash = keys.hash_of(key);
+			const std::string* name = keys.find(key, hash);
+			if (name == nullptr) {
+				name = new (strings.allocate()) std::string(key);
+				keys.insert(name, hash);
+			}
+			return name;
+		}
+
+		void acquire() {
+			refs++;
+		}
+
+		void release() {
+			if (--refs == 0 && !reclaimer::hand_over(this)) {
+				delete this;
+			}
+		}
+
+		size_t footprint() const {
+			return block_bytes + strings.bytes + texts.bytes + lists.bytes + dicts.bytes + impls.bytes + nodes.bytes;
+		}
+	};
+
+	// Frees large documents on a thread of its own while enabled, so that dropping
+	// one costs the thread that drops it no more than handing it over
+	struct reclaimer {
+		static constexpr size_t LARGE_SIZE = 4096;
+		static constexpr size_t LARGE_BYTES = 16 * arena::CHUNK;
+
+		struct task {
+			json_type kind;
+			shared* contents;
+			arena* memory;
+		};
+
+		static inline std::atomic<bool> enabled{false};
+
+		std::mutex mutex;
+		std::condition_variable ready;
+		std::condition_variable idle;
+		std::vector<task> tasks;
+		size_t running = 0;
+		std::thread worker;
+
+		// Never destroyed, since documents may still be dropped while the program exits
+		static reclaimer& instance() {
+			static reclaimer* single = new reclaimer;
+			return *single;
+		}
+
+		static bool hand_over(arena* memory) {
+			if (!enabled || memory->footprint() < LARGE_BYTES) {
+				return false;
+			}
+			return instance().push(task{JSON_NULL, nullptr, memory});
+		}
+
+		static bool hand_over(json_type kind, shared* contents) {
+			size_t size = kind == JSON_LIST ? static_cast<elements*>(contents)->size :
+				kind == JSON_DICT ? static_cast<pairs*>(contents)->size : 0;
+			if (!enabled || size < LARGE_SIZE) {
+				return false;
+			}
+			return instance().push(task{kind, contents, nullptr});
+		}
+
+		// Queues work unless it was disabled in the meantime, which is checked under the
+		// lock that disabling takes, so that nothing is queued after the drain that follows
+		bool push(task work) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!enabled) {
+				return false;
+			}
+			tasks.push_back(work);
+			if (!worker.joinable()) {
+				worker = std::thread([this] {
+					run();
+				});
+				worker.detach();
+			}
+			ready.notify_one();
+			return true;
+		}
+
+		void enable(bool on) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				enabled = on;
+			}
+			if (!on) {
+				drain();
+			}
+		}
+
+		void run() {
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;) {
+				ready.wait(lock, [this] {
+					return !tasks.empty();
+				});
+				std::vector<task> batch;
+				batch.swap(tasks);
+				running = batch.size();
+				lock.unlock();
+
+				for (const task& work : batch) {
+					if (work.memory != nullptr) {
+						delete work.memory;
+					} else {
+						free_contents(work.kind, work.contents);
+					}
+				}
+
+				lock.lock();
+				running = 0;
+				if (tasks.empty()) {
+					idle.notify_all();
+				}
+			}
+		}
+
+		// Waits for everything handed over so far to be freed
+		void drain() {
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this] {
+				return tasks.empty() && running == 0;
+			});
+		}
+	};
+
+	// Type in the lowest bits, then whether this node lives in an arena, and above them the
+	// arena where its contents, elements and pairs are allocated, or nothing for the heap.
+	// Nodes outside of the arena hold a reference to it, while nodes inside never leave it
+	static constexpr uintptr_t TYPE_BITS = 7;
+	static constexpr uintptr_t IN_ARENA = 8;
+	uintptr_t header;
+
+	// Scalars are stored inline, everything else out of line next to the rest of the document
+	union {
+		double n;
+		bool b;
+		text* s;
+		elements* l;
+		pairs* d;
+	};
+
+	impl(arena* allocator = nullptr)
+		: header((uintptr_t) allocator | (allocator != nullptr ? IN_ARENA : 0) | JSON_NULL), l(nullptr) {}
 
-	impl(const impl& rhs) {
+	impl(const impl& rhs) : impl() {
 		*this = rhs;
 	}
 
@@ -31,69 +420,548 @@ struct json::impl {
 		clear();
 	}
 
+	json_type type() const {
+		return json_type(header & TYPE_BITS);
+	}
+
+	void set_type(json_type kind) {
+		header = (header & ~TYPE_BITS) | kind;
+	}
+
+	arena* owner() const {
+		return (arena*) (header & ~(TYPE_BITS | IN_ARENA));
+	}
+
+	void set_owner(arena* allocator) {
+		header = (header & (TYPE_BITS | IN_ARENA)) | (uintptr_t) allocator;
+	}
+
+	bool in_arena() const {
+		return header & IN_ARENA;
+	}
+
+	// Whether this heap node shares contents in the arena of another document, which
+	// may be read by other threads, so that nothing may be allocated there on its behalf
+	bool is_guest() const {
+		return !in_arena() && owner() != nullptr && owner()->root != this;
+	}
+
+	// Arena of the nodes added to this container, or null for the heap
+	arena* home() const {
+		return is_guest() ? nullptr : owner();
+	}
+
+	bool has_contents() const {
+		return type() >= JSON_STR;
+	}
+
+	shared& contents() const {
+		if (type() == JSON_STR) {
+			return *s;
+		} else if (type() == JSON_LIST) {
+			return *l;
+		}
+		return *d;
+	}
+
 	void clear() {
-		type = JSON_NULL;
-		s.clear();
-		while (head != nullptr) {
-			list* previous = head;
-			head = head->next;
-			delete previous;
+		json_type kind = type();
+		shared* orphan = detach();
+		if (orphan != nullptr && !reclaimer::hand_over(kind, orphan)) {
+			free_contents(kind, orphan);
+		}
+	}
+
+	// Leaves this node null, giving up its arena and its contents, which are
+	// returned when they are on the heap and nothing else holds them
+	shared* detach() {
+		shared* orphan = nullptr;
+		if (has_contents() && --contents().refs == 0 && owner() == nullptr) {
+			orphan = &contents();
+		}
+
+		if (owner() != nullptr && !in_arena()) {
+			if (owner()->root == this) {
+				owner()->root = nullptr;
+			}
+			owner()->release();
+			set_owner(nullptr);
+		}
+		set_type(JSON_NULL);
+		return orphan;
+	}
+
+	// Frees heap contents along with everything only they hold, keeping the contents
+	// still to free on a stack of its own, so that deep trees need no deep recursion
+	static void free_contents(json_type kind, shared* contents) {
+		std::vector<std::pair<json_type, shared*>> pending;
+		for (;;) {
+			if (kind == JSON_STR) {
+				delete static_cast<text*>(contents);
+			} else if (kind == JSON_LIST) {
+				elements* array = static_cast<elements*>(contents);
+				for (size_t i = 0; i < array->size; i++) {
+					orphan_of(array->items[i], pending);
+				}
+				::operator delete(array->items);
+				delete array;
+			} else {
+				pairs* dict = static_cast<pairs*>(contents);
+				while (dict->head != nullptr) {
+					list* previous = dict->head;
+					dict->head = dict->head->next;
+					orphan_of(previous->value, pending);
+					delete static_cast<owned_list*>(previous);
+				}
+				delete dict;
+			}
+
+			if (pending.empty()) {
+				return;
+			}
+			kind = pending.back().first;
+			contents = pending.back().second;
+			pending.pop_back();
+		}
+	}
+
+	// Frees a heap value, queueing its contents when nothing else holds them
+	static void orphan_of(json& value, std::vector<std::pair<json_type, shared*>>& pending) {
+		if (value.pimpl != nullptr) {
+			json_type kind = value.pimpl->type();
+			shared* orphan = value.pimpl->detach();
+			if (orphan != nullptr) {
+				pending.emplace_back(kind, orphan);
+			}
+			delete value.pimpl;
+			value.pimpl = nullptr;
+		}
+	}
+
+	// Turn a null node into an empty string, list or dictionary
+	std::string& make_string() {
+		s = owner() == nullptr ? new text : new (owner()->texts.allocate()) text;
+		set_type(JSON_STR);
+		return s->value;
+	}
+
+	void make_list() {
+		l = owner() == nullptr ? new elements : new (owner()->lists.allocate()) elements;
+		set_type(JSON_LIST);
+	}
+
+	void make_dict() {
+		d = owner() == nullptr ? new pairs : new (owner()->dicts.allocate()) pairs;
+		set_type(JSON_DICT);
+	}
+
+	// Whether the contents of rhs can be referred to from here
+	bool can_share(const impl& rhs) const {
+		return rhs.owner() == owner() || (rhs.owner() != nullptr && !in_arena());
+	}
+
+	// A level of a value still to be copied or moved into the node made for it. Values are
+	// copied and moved a level at a time, keeping the levels left on a stack of their own,
+	// so that deep values need no deep recursion
+	struct transfer {
+		impl* target;
+		impl* source;
+		bool move;
+	};
+
+	using transfers = std::vector<transfer>;
+
+	// Whether copying or moving rhs into this node goes on to the levels below it, which
+	// are then left to the stack. The others are done right away
+	bool goes_below(const impl& rhs, bool move) const {
+		json_type kind = rhs.type();
+		if (kind < JSON_LIST || (kind == JSON_LIST ? rhs.l->size : rhs.d->size) == 0) {
+			return false;
+		}
+		return !can_share(rhs) || (!move && rhs.contents().leaked);
+	}
+
+	// Copies and moves the levels left, along with those they leave in turn
+	static void finish(transfers& pending) {
+		while (!pending.empty()) {
+			transfer next = pending.back();
+			pending.pop_back();
+			if (next.move) {
+				next.target->move_level(*next.source, pending);
+			} else {
+				next.target->assign(*next.source, pending);
+			}
 		}
-		tail = nullptr;
 	}
 
+	// Shares the contents of rhs when possible, copying the top level otherwise
 	impl& operator=(const impl& rhs) {
+		transfers pending;
+		assign(rhs, pending);
+		finish(pending);
+		return *this;
+	}
+
+	void assign(const impl& rhs, transfers& pending) {
 		clear();
-		type = rhs.type;
+		if (rhs.has_contents() && !rhs.contents().leaked && can_share(rhs)) {
+			if (owner() == nullptr && rhs.owner() != nullptr) {
+				set_owner(rhs.owner());
+				owner()->acquire();
+			}
+			l = rhs.l;
+			contents().refs++;
+		} else {
+			copy_level(rhs, pending);
+		}
+		set_type(rhs.type());
+	}
+
+	// Copies the top level of rhs into this null node, its elements and values being shared
+	void copy_level(const impl& rhs) {
+		transfers pending;
+		copy_level(rhs, pending);
+		finish(pending);
+	}
 
-		n = rhs.n;
-		b = rhs.b;
-		s = rhs.s;
+	void copy_level(const impl& rhs, transfers& pending) {
+		if (rhs.type() == JSON_NUMBER) {
+			n = rhs.n;
+		} else if (rhs.type() == JSON_BOOL) {
+			b = rhs.b;
+		} else if (rhs.type() == JSON_STR) {
+			make_string() = rhs.s->value;
+		} else if (rhs.type() == JSON_LIST) {
+			make_list();
+			reserve(rhs.l->size);
+			for (size_t i = 0; i < rhs.l->size; i++) {
+				append_item(copy_of(rhs.l->items[i], pending));
+			}
+		} else if (rhs.type() == JSON_DICT) {
+			make_dict();
+			bool shared_keys = owner() != nullptr && rhs.owner() == owner();
+			list* ptr = rhs.d->head;
+			while (ptr != nullptr) {
+				if (shared_keys) {
+					append(ptr->key, copy_of(ptr->value, pending));
+				} else {
+					append(*ptr->key, copy_of(ptr->value, pending));
+				}
+				ptr = ptr->next;
+			}
+		}
+		set_type(rhs.type());
+	}
 
-		list* ptr = rhs.head;
-		while (ptr != nullptr) {
-			push_back(ptr->value);
-			ptr = ptr->next;
+	// Gets contents of its own before they change, leaking them if references into them
+	// are about to be handed out
+	void own(bool leak) {
+		if (!has_contents()) {
+			return;
+		}
+		if (contents().refs > 1 || is_guest()) {
+			// The top level is copied where elements made before were put, holding on to
+			// the contents until it is done, since other copies may let go of them meanwhile.
+			// A guest copies it onto the heap, holding the arena it leaves just as long
+			impl original;
+			original.header = header;
+			original.l = l;
+			arena* source = is_guest() ? owner() : nullptr;
+			if (source != nullptr) {
+				set_owner(nullptr);
+			}
+			set_type(JSON_NULL);
+			copy_level(original);
+
+			json_type kind = original.type();
+			shared* orphan = &original.contents();
+			if (--orphan->refs == 0 && original.owner() == nullptr && !reclaimer::hand_over(kind, orphan)) {
+				free_contents(kind, orphan);
+			}
+			original.header = 0;
+			if (source != nullptr) {
+				source->release();
+			}
+		}
+		if (leak) {
+			contents().leaked = true;
 		}
-		return *this;
 	}
 
-	void push_back(const std::pair<std::string, json>& value) {
-		list* node = new list;
-		node->value = value;
-		node->next = nullptr;
+	// Moves the contents of rhs, which is left null, stealing them when both live
+	// in the same place and moving them a level at a time otherwise
+	void take(impl& rhs) {
+		transfers pending;
+		move_level(rhs, pending);
+		finish(pending);
+		rhs.clear();
+	}
+
+	// Moves the top level of rhs into this node. What is left of rhs is only freed by
+	// the take that started it, since the levels below may still be moved from until then
+	void move_level(impl& rhs, transfers& pending) {
+		clear();
+		json_type kind = rhs.type();
+		arena* source = rhs.owner();
+
+		if (kind == JSON_NULL) {
+		} else if (kind == JSON_NUMBER) {
+			n = rhs.n;
+		} else if (kind == JSON_BOOL) {
+			b = rhs.b;
+		} else if (can_share(rhs)) {
+			if (owner() == nullptr && source != nullptr) {
+				set_owner(source);
+				source->acquire();
+			}
+			l = rhs.l;
+			rhs.set_type(JSON_NULL);
+		} else if (rhs.contents().refs > 1) {
+			// Other copies still need the contents
+			copy_level(rhs, pending);
+		} else if (kind == JSON_STR) {
+			make_string() = std::move(rhs.s->value);
+		} else if (kind == JSON_LIST) {
+			make_list();
+			reserve(rhs.l->size);
+			for (size_t i = 0; i < rhs.l->size; i++) {
+				append_item(adopt(rhs.l->items[i], pending));
+			}
+		} else {
+			make_dict();
+			list* ptr = rhs.d->head;
+			while (ptr != nullptr) {
+				append(*ptr->key, adopt(ptr->value, pending));
+				ptr = ptr->next;
+			}
+		}
+		set_type(kind);
+	}
+
+	// New null value, allocated next to the rest of the container
+	impl* create() {
+		arena* allocator = home();
+		return allocator == nullptr ? nullptr : new (allocator->impls.allocate()) impl(allocator);
+	}
+
+	// Copy of value, allocated next to the rest of the container. It is made before the
+	// container changes, since value may be one of its elements or one of its ancestors
+	impl* copy_of(const json& value) {
+		transfers pending;
+		impl* copy = copy_of(value, pending);
+		finish(pending);
+		return copy;
+	}
+
+	// Node for a copy of value, which is left to pending when it has levels below
+	impl* copy_of(const json& value, transfers& pending) {
+		if (value.pimpl == nullptr) {
+			return create();
+		}
+		impl* copy = home() == nullptr ? new impl : create();
+		if (copy->goes_below(*value.pimpl, false)) {
+			pending.push_back(transfer{copy, value.pimpl, false});
+		} else {
+			copy->assign(*value.pimpl, pending);
+		}
+		return copy;
+	}
 
-		if (tail == nullptr) {
-			head = node;
+	// Contents of value, which is left null, moved next to the rest of the container.
+	// A heap node going into a heap container is adopted as it is, while one going into
+	// an arena has its whole subtree moved over, as copies of nodes of that arena may be
+	// found anywhere in it, and would keep the arena alive from inside if kept on the heap
+	impl* adopt(json& value) {
+		if (value.pimpl == nullptr) {
+			return create();
+		}
+		if (home() == nullptr && !value.pimpl->in_arena()) {
+			return std::exchange(value.pimpl, nullptr);
+		}
+		impl* node = home() == nullptr ? new impl : create();
+		node->take(*value.pimpl);
+		return node;
+	}
+
+	// Node for the contents of value, which is left to pending when it has levels below
+	impl* adopt(json& value, transfers& pending) {
+		if (value.pimpl == nullptr) {
+			return create();
+		}
+		if (home() == nullptr && !value.pimpl->in_arena()) {
+			return std::exchange(value.pimpl, nullptr);
+		}
+		impl* node = home() == nullptr ? new impl : create();
+		if (node->goes_below(*value.pimpl, true)) {
+			pending.push_back(transfer{node, value.pimpl, true});
+		} else {
+			node->move_level(*value.pimpl, pending);
+		}
+		return node;
+	}
+
+	void reserve(size_t count) {
+		if (count <= l->capacity) {
+			return;
+		}
+
+		json* array;
+		if (owner() == nullptr) {
+			array = (json*) ::operator new(count * sizeof(json));
 		} else {
-			tail->next = node;
+			array = (json*) owner()->allocate(count * sizeof(json));
+		}
+
+		// Elements are relocated by their pointer, so that the impls stay where they are
+		for (size_t i = 0; i < l->size; i++) {
+			new (array + i) json;
+			array[i].pimpl = l->items[i].pimpl;
+			l->items[i].pimpl = nullptr;
+		}
+		if (owner() == nullptr) {
+			for (size_t i = 0; i < l->size; i++) {
+				l->items[i].~json();
+			}
+			::operator delete(l->items);
 		}
-		tail = node;
+		l->items = array;
+		l->capacity = count;
 	}
 
-	void push_front(const std::pair<std::string, json>& value) {
-		list* node = new list;
-		node->value = value;
-		node->next = head;
+	json& append_item(impl* value) {
+		if (l->size == l->capacity) {
+			reserve(std::max<size_t>(4, l->capacity * 2));
+		}
+		json* item = new (l->items + l->size++) json;
+		item->pimpl = value;
+		return *item;
+	}
+
+	json& append_item() {
+		return append_item(create());
+	}
+
+	json& prepend_item(impl* value) {
+		append_item(value);
+		json* last = l->items + l->size - 1;
+		value = last->pimpl;
+		for (json* ptr = last; ptr != l->items; ptr--) {
+			ptr->pimpl = ptr[-1].pimpl;
+		}
+		l->items->pimpl = value;
+		return *l->items;
+	}
+
+	list* append(std::string key, impl* value) {
+		if (owner() != nullptr) {
+			return append(owner()->keep(key), value);
+		}
+
+		owned_list* node = new owned_list;
+		node->name = std::move(key);
+		node->key = &node->name;
+		return link(node, value);
+	}
+
+	// Appends a key kept in the arena of this dictionary
+	list* append(const std::string* key, impl* value) {
+		list* node = new (owner()->nodes.allocate()) list;
+		node->key = key;
+		return link(node, value);
+	}
+
+	list* link(list* node, impl* value) {
+		node->value.pimpl = value;
+		node->next = nullptr;
 
-		if (head == nullptr) {
-			tail = node;
+		if (d->tail == nullptr) {
+			d->head = node;
+		} else {
+			d->tail->next = node;
 		}
-		head = node;
+		d->tail = node;
+		d->size++;
+
+		if (d->index != nullptr) {
+			d->index->insert(node, key_index::hash_of(*node->key));
+		} else if (d->size > INDEX_THRESHOLD) {
+			d->index = new key_index;
+			for (list* ptr = d->head; ptr != nullptr; ptr = ptr->next) {
+				d->index->insert(ptr, key_index::hash_of(*ptr->key));
+			}
+		}
+		return node;
+	}
+
+	list* append(std::string key) {
+		return append(std::move(key), create());
 	}
 
-	list* get(const std::string& key) {
-		list* ptr = head;
-		while (ptr != nullptr && ptr->value.first != key) {
+	list* get(std::string_view key) const {
+		if (d->index != nullptr) {
+			return d->index->find(key, key_index::hash_of(key));
+		}
+
+		list* ptr = d->head;
+		if (owner() != nullptr && owner()->interning) {
+			// A key missing from the arena is in none of its dictionaries, and
+			// the others can be told apart by their address
+			const std::string* name = owner()->keys.find(key, key_index::hash_of(key));
+			while (ptr != nullptr && ptr->key != name) {
+				ptr = ptr->next;
+			}
+			return name == nullptr ? nullptr : ptr;
+		}
+
+		while (ptr != nullptr && *ptr->key != key) {
 			ptr = ptr->next;
 		}
 		return ptr;
 	}
+
+	// A null json has no node at all until it is modified
+	static impl& of(json& value) {
+		if (value.pimpl == nullptr) {
+			value.pimpl = new impl;
+		}
+		return *value.pimpl;
+	}
+
+	static const impl& of(const json& value) {
+		return *value.pimpl;
+	}
+
+	static json_type type_of(const json& value) {
+		return value.pimpl == nullptr ? JSON_NULL : value.pimpl->type();
+	}
+
+	// Turns a null json into the root of a new document, whose nodes come from a fresh arena
+	static void start_document(json& value, bool intern_keys = false) {
+		impl& root = of(value);
+		root.clear();
+		if (!root.in_arena()) {
+			root.set_owner(new arena);
+			root.owner()->root = &root;
+			root.owner()->interning = intern_keys;
+		}
+	}
+
+	// The parsers and the writers below are free functions, which json.hpp can't
+	// befriend, so they reach the internals through here
+	friend auto& json_node(json& value) {
+		return of(value);
+	}
+
+	friend auto& json_node(const json& value) {
+		return of(value);
+	}
 };
 
-json::json() {
-	pimpl = new impl;
-}
+using json_impl = std::remove_reference_t<decltype(json_node(std::declval<json&>()))>;
+
+static_assert(sizeof(json_impl) <= 16, "json::impl is meant to stay two words long");
+
+json::json() : pimpl(nullptr) {}
 
 json::json(const json& rhs) : json() {
 	*this = rhs;
@@ -104,47 +972,62 @@ json::json(json&& rhs) : json() {
 }
 
 json::~json() {
-	delete pimpl;
+	if (pimpl != nullptr && !pimpl->in_arena()) {
+		delete pimpl;
+	}
 }
 
 json& json::operator=(const json& rhs) {
 	if (this != &rhs) {
-		*pimpl = *rhs.pimpl;
+		if (rhs.pimpl == nullptr) {
+			set_null();
+		} else {
+			impl::of(*this) = *rhs.pimpl;
+		}
 	}
 	return *this;
 }
 
 json& json::operator=(json&& rhs) {
 	if (this != &rhs) {
-		delete pimpl;
-		pimpl = rhs.pimpl;
-		rhs.pimpl = nullptr;
+		if ((pimpl != nullptr && pimpl->in_arena()) || (rhs.pimpl != nullptr && rhs.pimpl->in_arena())) {
+			// Nodes in an arena stay where they are, so only their contents can move
+			if (rhs.pimpl == nullptr) {
+				set_null();
+			} else {
+				impl::of(*this).take(*rhs.pimpl);
+			}
+		} else {
+			delete pimpl;
+			pimpl = rhs.pimpl;
+			rhs.pimpl = nullptr;
+		}
 	}
 	return *this;
 }
 
 bool json::is_list() const {
-	return pimpl->type == impl::json_type::JSON_LIST;
+	return impl::type_of(*this) == impl::json_type::JSON_LIST;
 }
 
 bool json::is_dictionary() const {
-	return pimpl->type == impl::json_type::JSON_DICT;
+	return impl::type_of(*this) == impl::json_type::JSON_DICT;
 }
 
 bool json::is_string() const {
-	return pimpl->type == impl::json_type::JSON_STR;
+	return impl::type_of(*this) == impl::json_type::JSON_STR;
 }
 
 bool json::is_number() const {
-	return pimpl->type == impl::json_type::JSON_NUMBER;
+	return impl::type_of(*this) == impl::json_type::JSON_NUMBER;
 }
 
 bool json::is_bool() const {
-	return pimpl->type == impl::json_type::JSON_BOOL;
+	return impl::type_of(*this) == impl::json_type::JSON_BOOL;
 }
 
 bool json::is_null() const {
-	return pimpl->type == impl::json_type::JSON_NULL;
+	return impl::type_of(*this) == impl::json_type::JSON_NULL;
 }
 
 const json& json::operator[](const std::string& rhs) const {
@@ -156,7 +1039,7 @@ const json& json::operator[](const std::string& rhs) const {
 	if (node == nullptr) {
 		throw json_exception{"Unable to create key '" + rhs + "' for const json&"};
 	}
-	return node->value.second;
+	return node->value;
 }
 
 json& json::operator[](const std::string& rhs) {
@@ -164,13 +1047,12 @@ json& json::operator[](const std::string& rhs) {
 		throw json_exception{"Wrong json& type for operator[]"};
 	}
 
+	pimpl->own(true);
 	impl::list* node = pimpl->get(rhs);
 	if (node == nullptr) {
-		std::pair<std::string, json> pair(rhs, json());
-		insert(pair);
-		return pimpl->tail->value.second;
+		node = pimpl->append(rhs);
 	}
-	return node->value.second;
+	return node->value;
 }
 
 double& json::get_number() {
@@ -205,46 +1087,58 @@ std::string& json::get_string() {
 	if (!is_string()) {
 		throw json_exception{"Wrong json& type for get_string"};
 	}
-	return pimpl->s;
+	pimpl->own(true);
+	return pimpl->s->value;
 }
 
 const std::string& json::get_string() const {
 	if (!is_string()) {
 		throw json_exception{"Wrong const json& type for get_string"};
 	}
-	return pimpl->s;
+	return pimpl->s->value;
 }
 
 void json::set_string(const std::string& string) {
-	pimpl->clear();
-	pimpl->s = string;
-	pimpl->type = impl::json_type::JSON_STR;
+	impl& node = impl::of(*this);
+	if (node.type() == impl::json_type::JSON_STR) {
+		node.own(false);
+		node.s->value = string;
+		return;
+	}
+	node.clear();
+	node.make_string() = string;
 }
 
 void json::set_bool(bool boolean) {
-	pimpl->clear();
-	pimpl->b = boolean;
-	pimpl->type = impl::json_type::JSON_BOOL;
+	impl& node = impl::of(*this);
+	node.clear();
+	node.b = boolean;
+	node.set_type(impl::json_type::JSON_BOOL);
 }
 
 void json::set_number(double number) {
-	pimpl->clear();
-	pimpl->n = number;
-	pimpl->type = impl::json_type::JSON_NUMBER;
+	impl& node = impl::of(*this);
+	node.clear();
+	node.n = number;
+	node.set_type(impl::json_type::JSON_NUMBER);
 }
 
 void json::set_null() {
-	pimpl->clear();
+	if (pimpl != nullptr) {
+		pimpl->clear();
+	}
 }
 
 void json::set_list() {
-	pimpl->clear();
-	pimpl->type = impl::json_type::JSON_LIST;
+	impl& node = impl::of(*this);
+	node.clear();
+	node.make_list();
 }
 
 void json::set_dictionary() {
-	pimpl->clear();
-	pimpl->type = impl::json_type::JSON_DICT;
+	impl& node = impl::of(*this);
+	node.clear();
+	node.make_dict();
 }
 
 void json::push_front(const json& rhs) {
@@ -252,7 +1146,9 @@ void json::push_front(const json& rhs) {
 		throw json_exception{"Wrong json& type for push_front"};
 	}
 
-	pimpl->push_front(std::pair<std::string, json>(std::string(), rhs));
+	impl* value = pimpl->copy_of(rhs);
+	pimpl->own(false);
+	pimpl->prepend_item(value);
 }
 
 void json::push_back(const json& rhs) {
@@ -260,7 +1156,9 @@ void json::push_back(const json& rhs) {
 		throw json_exception{"Wrong json& type for push_back"};
 	}
 
-	pimpl->push_back(std::pair<std::string, json>(std::string(), rhs));
+	impl* value = pimpl->copy_of(rhs);
+	pimpl->own(false);
+	pimpl->append_item(value);
 }
 
 void json::insert(const std::pair<std::string, json>& rhs) {
@@ -268,36 +1166,190 @@ void json::insert(const std::pair<std::string, json>& rhs) {
 		throw json_exception{"Wrong json& type for insert"};
 	}
 
-	pimpl->push_back(rhs);
+	impl* value = pimpl->copy_of(rhs.second);
+	pimpl->own(false);
+	pimpl->append(rhs.first, value);
 }
 
-struct json::list_iterator {
-	using iterator_category = std::forward_iterator_tag;
-	using value_type = json;
-	using pointer = value_type*;
-	using reference = value_type&;
-
-	list_iterator(impl::list* node) : ptr(node) {}
+// Extensions to the interface of json.hpp, which is fixed
 
-	reference operator*() const {
-		return ptr->value.second;
+size_t json_size(const json& value) {
+	if (!value.is_list() && !value.is_dictionary()) {
+		throw json_exception{"Wrong const json& type for json_size"};
 	}
+	const json_impl& node = json_node(value);
+	return value.is_list() ? node.l->size : node.d->size;
+}
 
-	pointer operator->() const {
-		return &ptr->value.second;
+json& json_at(json& value, size_t index) {
+	if (!value.is_list()) {
+		throw json_exception{"Wrong json& type for json_at"};
 	}
 
-	list_iterator& operator++() {
-		ptr = ptr->next;
-		return *this;
+	json_impl& node = json_node(value);
+	node.own(true);
+	if (index >= node.l->size) {
+		throw json_exception{"Index " + std::to_string(index) + " out of range for json&"};
+	}
+	return node.l->items[index];
+}
+
+const json& json_at(const json& value, size_t index) {
+	if (!value.is_list()) {
+		throw json_exception{"Wrong const json& type for json_at"};
+	}
+
+	const json_impl& node = json_node(value);
+	if (index >= node.l->size) {
+		throw json_exception{"Index " + std::to_string(index) + " out of range for const json&"};
+	}
+	return node.l->items[index];
+}
+
+void json_reserve(json& value, size_t capacity) {
+	if (!value.is_list()) {
+		throw json_exception{"Wrong json& type for json_reserve"};
+	}
+	json_impl& node = json_node(value);
+	node.own(false);
+	node.reserve(capacity);
+}
+
+// Counterparts of push_front, push_back and insert which move the value in instead of copying it
+void json_push_front(json& list, json&& value) {
+	if (!list.is_list()) {
+		throw json_exception{"Wrong json& type for json_push_front"};
+	}
+
+	json_impl& node = json_node(list);
+	json_impl* moved = node.adopt(value);
+	node.own(false);
+	node.prepend_item(moved);
+}
+
+void json_push_back(json& list, json&& value) {
+	if (!list.is_list()) {
+		throw json_exception{"Wrong json& type for json_push_back"};
+	}
+
+	json_impl& node = json_node(list);
+	json_impl* moved = node.adopt(value);
+	node.own(false);
+	node.append_item(moved);
+}
+
+void json_insert(json& dictionary, std::pair<std::string, json>&& pair) {
+	if (!dictionary.is_dictionary()) {
+		throw json_exception{"Wrong json& type for json_insert"};
+	}
+
+	json_impl& node = json_node(dictionary);
+	json_impl* moved = node.adopt(pair.second);
+	node.own(false);
+	node.append(std::move(pair.first), moved);
+}
+
+// Appends a null element to be filled in place
+json& json_emplace_back(json& list) {
+	if (!list.is_list()) {
+		throw json_exception{"Wrong json& type for json_emplace_back"};
+	}
+
+	json_impl& node = json_node(list);
+	node.own(true);
+	return node.append_item();
+}
+
+// Value of key, appended as null only if the key is missing, and whether it was appended
+std::pair<json&, bool> json_try_emplace(json& dictionary, std::string key) {
+	if (!dictionary.is_dictionary()) {
+		throw json_exception{"Wrong json& type for json_try_emplace"};
+	}
+
+	json_impl& node = json_node(dictionary);
+	node.own(true);
+	json_impl::list* pair = node.get(key);
+	if (pair != nullptr) {
+		return {pair->value, false};
+	}
+	return {node.append(std::move(key))->value, true};
+}
+
+// From now on, frees large documents dropped by any thread on a background thread, or
+// stops doing so, waiting until the ones handed over before are freed
+void json_background_reclaim(bool enabled) {
+	json_impl::reclaimer::instance().enable(enabled);
+}
+
+struct json::list_iterator {
+	using iterator_category = std::random_access_iterator_tag;
+	using value_type = json;
+	using difference_type = std::ptrdiff_t;
+	using pointer = value_type*;
+	using reference = value_type&;
+
+	list_iterator(json* element = nullptr, json* last = nullptr) : ptr(element), end(last) {}
+
+	reference operator*() const {
+		return *ptr;
+	}
+
+	pointer operator->() const {
+		return ptr;
+	}
+
+	reference operator[](difference_type offset) const {
+		return ptr[offset];
+	}
+
+	list_iterator& operator++() {
+		ptr++;
+		return *this;
 	}
 
 	list_iterator operator++(int) {
-		list_iterator it(ptr);
+		list_iterator it(ptr, end);
 		++(*this);
 		return it;
 	}
 
+	list_iterator& operator--() {
+		ptr--;
+		return *this;
+	}
+
+	list_iterator operator--(int) {
+		list_iterator it(ptr, end);
+		--(*this);
+		return it;
+	}
+
+	list_iterator& operator+=(difference_type offset) {
+		ptr += offset;
+		return *this;
+	}
+
+	list_iterator& operator-=(difference_type offset) {
+		ptr -= offset;
+		return *this;
+	}
+
+	list_iterator operator+(difference_type offset) const {
+		return list_iterator(ptr + offset, end);
+	}
+
+	list_iterator operator-(difference_type offset) const {
+		return list_iterator(ptr - offset, end);
+	}
+
+	difference_type operator-(const list_iterator& rhs) const {
+		return ptr - rhs.ptr;
+	}
+
+	friend list_iterator operator+(difference_type offset, const list_iterator& it) {
+		return it + offset;
+	}
+
 	bool operator==(const list_iterator& rhs) const {
 		return ptr == rhs.ptr;
 	}
@@ -306,57 +1358,119 @@ struct json::list_iterator {
 		return ptr != rhs.ptr;
 	}
 
-	operator bool() const {
-		return ptr != nullptr;
+	bool operator<(const list_iterator& rhs) const {
+		return ptr < rhs.ptr;
+	}
+
+	bool operator>(const list_iterator& rhs) const {
+		return ptr > rhs.ptr;
+	}
+
+	bool operator<=(const list_iterator& rhs) const {
+		return ptr <= rhs.ptr;
+	}
+
+	bool operator>=(const list_iterator& rhs) const {
+		return ptr >= rhs.ptr;
+	}
+
+	explicit operator bool() const {
+		return ptr != end;
 	}
 
 	private:
-		impl::list* ptr;
+		json* ptr;
+		json* end;
 };
 
 json::list_iterator json::begin_list() {
 	if (!is_list()) {
 		throw json_exception{"Wrong json& type for begin_list"};
 	}
+	pimpl->own(true);
 
-	return list_iterator(pimpl->head);
+	return list_iterator(pimpl->l->items, pimpl->l->items + pimpl->l->size);
 }
 
 json::list_iterator json::end_list() {
 	if (!is_list()) {
 		throw json_exception{"Wrong json& type for end_list"};
 	}
+	pimpl->own(true);
 
-	return list_iterator(nullptr);
+	json* end = pimpl->l->items + pimpl->l->size;
+	return list_iterator(end, end);
 }
 
 struct json::const_list_iterator {
-	using iterator_category = std::forward_iterator_tag;
+	using iterator_category = std::random_access_iterator_tag;
 	using value_type = const json;
+	using difference_type = std::ptrdiff_t;
 	using pointer = value_type*;
 	using reference = value_type&;
 
-	const_list_iterator(impl::list* node) : ptr(node) {}
+	const_list_iterator(json* element = nullptr, json* last = nullptr) : ptr(element), end(last) {}
 
 	reference operator*() const {
-		return ptr->value.second;
+		return *ptr;
 	}
 
 	pointer operator->() const {
-		return &ptr->value.second;
+		return ptr;
+	}
+
+	reference operator[](difference_type offset) const {
+		return ptr[offset];
 	}
 
 	const_list_iterator& operator++() {
-		ptr = ptr->next;
+		ptr++;
 		return *this;
 	}
 
 	const_list_iterator operator++(int) {
-		const_list_iterator it(ptr);
+		const_list_iterator it(ptr, end);
 		++(*this);
 		return it;
 	}
 
+	const_list_iterator& operator--() {
+		ptr--;
+		return *this;
+	}
+
+	const_list_iterator operator--(int) {
+		const_list_iterator it(ptr, end);
+		--(*this);
+		return it;
+	}
+
+	const_list_iterator& operator+=(difference_type offset) {
+		ptr += offset;
+		return *this;
+	}
+
+	const_list_iterator& operator-=(difference_type offset) {
+		ptr -= offset;
+		return *this;
+	}
+
+	const_list_iterator operator+(difference_type offset) const {
+		return const_list_iterator(ptr + offset, end);
+	}
+
+	const_list_iterator operator-(difference_type offset) const {
+		return const_list_iterator(ptr - offset, end);
+	}
+
+	difference_type operator-(const const_list_iterator& rhs) const {
+		return ptr - rhs.ptr;
+	}
+
+	friend const_list_iterator operator+(difference_type offset, const const_list_iterator& it) {
+		return it + offset;
+	}
+
 	bool operator==(const const_list_iterator& rhs) const {
 		return ptr == rhs.ptr;
 	}
@@ -365,12 +1479,29 @@ struct json::const_list_iterator {
 		return ptr != rhs.ptr;
 	}
 
-	operator bool() const {
-		return ptr != nullptr;
+	bool operator<(const const_list_iterator& rhs) const {
+		return ptr < rhs.ptr;
+	}
+
+	bool operator>(const const_list_iterator& rhs) const {
+		return ptr > rhs.ptr;
+	}
+
+	bool operator<=(const const_list_iterator& rhs) const {
+		return ptr <= rhs.ptr;
+	}
+
+	bool operator>=(const const_list_iterator& rhs) const {
+		return ptr >= rhs.ptr;
+	}
+
+	explicit operator bool() const {
+		return ptr != end;
 	}
 
 	private:
-		impl::list* ptr;
+		json* ptr;
+		json* end;
 };
 
 json::const_list_iterator json::begin_list() const {
@@ -378,7 +1509,7 @@ json::const_list_iterator json::begin_list() const {
 		throw json_exception{"Wrong const json& type for begin_list"};
 	}
 
-	return const_list_iterator(pimpl->head);
+	return const_list_iterator(pimpl->l->items, pimpl->l->items + pimpl->l->size);
 }
 
 json::const_list_iterator json::end_list() const {
@@ -386,23 +1517,32 @@ json::const_list_iterator json::end_list() const {
 		throw json_exception{"Wrong const json& type for end_list"};
 	}
 
-	return const_list_iterator(nullptr);
+	json* end = pimpl->l->items + pimpl->l->size;
+	return const_list_iterator(end, end);
 }
 
+// Keys may be shared between dictionaries, so pairs are handed out as references to their halves
 struct json::dictionary_iterator {
 	using iterator_category = std::forward_iterator_tag;
 	using value_type = std::pair<std::string, json>;
-	using pointer = value_type*;
-	using reference = value_type&;
+	using reference = std::pair<const std::string&, json&>;
+
+	struct pointer {
+		reference pair;
+
+		const reference* operator->() const {
+			return &pair;
+		}
+	};
 
 	dictionary_iterator(impl::list* node) : ptr(node) {}
 
 	reference operator*() const {
-		return ptr->value;
+		return reference(*ptr->key, ptr->value);
 	}
 
 	pointer operator->() const {
-		return &ptr->value;
+		return pointer{**this};
 	}
 
 	dictionary_iterator& operator++() {
@@ -436,14 +1576,16 @@ json::dictionary_iterator json::begin_dictionary() {
 	if (!is_dictionary()) {
 		throw json_exception{"Wrong json& type for begin_dictionary"};
 	}
+	pimpl->own(true);
 
-	return dictionary_iterator(pimpl->head);
+	return dictionary_iterator(pimpl->d->head);
 }
 
 json::dictionary_iterator json::end_dictionary() {
 	if (!is_dictionary()) {
 		throw json_exception{"Wrong json& type for end_dictionary"};
 	}
+	pimpl->own(true);
 
 	return dictionary_iterator(nullptr);
 }
@@ -451,17 +1593,24 @@ json::dictionary_iterator json::end_dictionary() {
 struct json::const_dictionary_iterator {
 	using iterator_category = std::forward_iterator_tag;
 	using value_type = const std::pair<std::string, json>;
-	using pointer = value_type*;
-	using reference = value_type&;
+	using reference = std::pair<const std::string&, const json&>;
+
+	struct pointer {
+		reference pair;
+
+		const reference* operator->() const {
+			return &pair;
+		}
+	};
 
 	const_dictionary_iterator(impl::list* node) : ptr(node) {}
 
 	reference operator*() const {
-		return ptr->value;
+		return reference(*ptr->key, ptr->value);
 	}
 
 	pointer operator->() const {
-		return &ptr->value;
+		return pointer{**this};
 	}
 
 	const_dictionary_iterator& operator++() {
@@ -496,7 +1645,7 @@ json::const_dictionary_iterator json::begin_dictionary() const {
 		throw json_exception{"Wrong const json& type for begin_dictionary"};
 	}
 
-	return const_dictionary_iterator(pimpl->head);
+	return const_dictionary_iterator(pimpl->d->head);
 }
 
 json::const_dictionary_iterator json::end_dictionary() const {
@@ -520,19 +1669,421 @@ json::const_dictionary_iterator json::end_dictionary() const {
 // where <Char> is a terminal with ascii from 0x20 to 0x7E with '"' = '\"',
 // and <Number> is a terminal represented as a double with no leading '.'
 
-static inline void parse_expect(std::istream& stream, std::string expected) {
-	std::string content;
-	content.resize(expected.size());
+// Same set of characters skipped by `stream >> symbol` in the "C" locale
+static inline bool is_space(char symbol) {
+	return symbol == ' ' || (symbol >= '\t' && symbol <= '\r');
+}
+
+static inline bool is_structural(char symbol) {
+	return symbol == '{' || symbol == '}' || symbol == '[' || symbol == ']' || symbol == ':' || symbol == ',';
+}
+
+// Character classes of a 64 bytes block, with one bit per byte
+struct block_masks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t space;
+	uint64_t structural;
+};
+
+static void classify_scalar(const char* block, block_masks& masks) {
+	masks = block_masks{};
+	for (size_t i = 0; i < 64; i++) {
+		uint64_t bit = (uint64_t) 1 << i;
+		if (block[i] == '"') {
+			masks.quote |= bit;
+		} else if (block[i] == '\\') {
+			masks.backslash |= bit;
+		} else if (is_space(block[i])) {
+			masks.space |= bit;
+		} else if (is_structural(block[i])) {
+			masks.structural |= bit;
+		}
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Using '{' = '[' | 0x20 and '}' = ']' | 0x20 to match both brackets with one comparison,
+// and (c - '\t') <= 4 unsigned for the '\t'...'\r' range
+static inline void classify_chunk(__m128i bytes, block_masks& masks) {
+	__m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+	__m128i control = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+
+	__m128i quote = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'));
+	__m128i backslash = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'));
+	__m128i space = _mm_or_si128(
+		_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+		_mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control)
+	);
+	__m128i structural = _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+		_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(':')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')))
+	);
+
+	masks.quote = (uint16_t) _mm_movemask_epi8(quote);
+	masks.backslash = (uint16_t) _mm_movemask_epi8(backslash);
+	masks.space = (uint16_t) _mm_movemask_epi8(space);
+	masks.structural = (uint16_t) _mm_movemask_epi8(structural);
+}
+
+static void classify_sse2(const char* block, block_masks& masks) {
+	masks = block_masks{};
+	for (size_t i = 0; i < 64; i += 16) {
+		block_masks chunk;
+		classify_chunk(_mm_loadu_si128((const __m128i*) (block + i)), chunk);
+		masks.quote |= chunk.quote << i;
+		masks.backslash |= chunk.backslash << i;
+		masks.space |= chunk.space << i;
+		masks.structural |= chunk.structural << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* block, block_masks& masks) {
+	masks = block_masks{};
+	for (size_t i = 0; i < 64; i += 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i*) (block + i));
+		__m256i lower = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+		__m256i control = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+
+		__m256i quote = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'));
+		__m256i backslash = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'));
+		__m256i space = _mm256_or_si256(
+			_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+			_mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8(4)), control)
+		);
+		__m256i structural = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(',')))
+		);
+
+		masks.quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8(quote) << i;
+		masks.backslash |= (uint64_t) (uint32_t) _mm256_movemask_epi8(backslash) << i;
+		masks.space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+		masks.structural |= (uint64_t) (uint32_t) _mm256_movemask_epi8(structural) << i;
+	}
+}
+#endif
+
+using classifier = void (*)(const char*, block_masks&);
+
+static classifier select_classifier() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		return classify_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return classify_sse2;
+	}
+#endif
+	return classify_scalar;
+}
+
+static const classifier classify = select_classifier();
+
+// Finds the first '"' or '\\' in [ptr, end), or end if there is none
+static const char* find_escape_scalar(const char* ptr, const char* end) {
+	while (ptr < end && *ptr != '"' && *ptr != '\\') {
+		ptr++;
+	}
+	return ptr;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static const char* find_escape_sse2(const char* ptr, const char* end) {
+	while (end - ptr >= 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*) ptr);
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')),
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))
+		));
+		if (mask != 0) {
+			return ptr + __builtin_ctz(mask);
+		}
+		ptr += 16;
+	}
+	return find_escape_scalar(ptr, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_escape_avx2(const char* ptr, const char* end) {
+	while (end - ptr >= 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i*) ptr);
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')),
+			_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'))
+		));
+		if (mask != 0) {
+			return ptr + __builtin_ctz(mask);
+		}
+		ptr += 32;
+	}
+	return find_escape_sse2(ptr, end);
+}
+#endif
+
+using finder = const char* (*)(const char*, const char*);
+
+static finder select_finder() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		return find_escape_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return find_escape_sse2;
+	}
+#endif
+	return find_escape_scalar;
+}
+
+static const finder find_escape = select_finder();
+
+// Finds the first byte of [ptr, end) which has to be escaped inside a string, that is
+// '"', '\\' or a control character, or end if there is none
+static const char* find_unsafe_scalar(const char* ptr, const char* end) {
+	while (ptr < end && *ptr != '"' && *ptr != '\\' && (unsigned char) *ptr >= 0x20) {
+		ptr++;
+	}
+	return ptr;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Control characters are the bytes left unchanged by a maximum with 0x1f
+static const char* find_unsafe_sse2(const char* ptr, const char* end) {
+	while (end - ptr >= 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*) ptr);
+		__m128i control = _mm_set1_epi8(0x1f);
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))),
+			_mm_cmpeq_epi8(_mm_max_epu8(bytes, control), control)
+		));
+		if (mask != 0) {
+			return ptr + __builtin_ctz(mask);
+		}
+		ptr += 16;
+	}
+	return find_unsafe_scalar(ptr, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_unsafe_avx2(const char* ptr, const char* end) {
+	while (end - ptr >= 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i*) ptr);
+		__m256i control = _mm256_set1_epi8(0x1f);
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'))),
+			_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, control), control)
+		));
+		if (mask != 0) {
+			return ptr + __builtin_ctz(mask);
+		}
+		ptr += 32;
+	}
+	return find_unsafe_sse2(ptr, end);
+}
+#endif
+
+static finder select_unsafe_finder() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		return find_unsafe_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return find_unsafe_sse2;
+	}
+#endif
+	return find_unsafe_scalar;
+}
+
+static const finder find_unsafe = select_unsafe_finder();
+
+// Bits of the bytes escaped by a backslash, where `carry` tells whether the
+// first byte is escaped by the end of the previous block and is updated for the next one
+static inline uint64_t escaped_bits(uint64_t backslash, uint64_t& carry) {
+	uint64_t escaped = carry;
+	carry = 0;
+
+	// Backslash runs are rare, so walking them one escape at a time is cheap
+	backslash &= ~escaped;
+	while (backslash != 0) {
+		unsigned position = __builtin_ctzll(backslash);
+		if (position == 63) {
+			carry = 1;
+			break;
+		}
+		escaped |= (uint64_t) 1 << (position + 1);
+		backslash &= ~((uint64_t) 3 << position);
+	}
+	return escaped;
+}
+
+// Bit i of the result is the parity of the bits 0...i of the argument
+static inline uint64_t prefix_xor(uint64_t bits) {
+	bits ^= bits << 1;
+	bits ^= bits << 2;
+	bits ^= bits << 4;
+	bits ^= bits << 8;
+	bits ^= bits << 16;
+	bits ^= bits << 32;
+	return bits;
+}
+
+// Positions of the structural characters, of the opening quotes and of the first byte
+// of each primitive outside strings, built one window at a time on demand.
+// This lets whitespace runs be jumped over in one step instead of being skipped per char
+struct structural_index {
+	static constexpr size_t WINDOW = 1 << 16;
+
+	const char* base = nullptr;
+	const char* indexed_end = nullptr;
+	std::vector<uint32_t> positions;
+	size_t next = 0;
+
+	// The window must start outside a string, right before a token or whitespace
+	void build(const char* start, const char* end) {
+		size_t size = std::min((size_t) (end - start), WINDOW);
+		base = start;
+		indexed_end = start + size;
+		positions.clear();
+		next = 0;
+
+		uint64_t prev_in_string = 0, prev_escape = 0, prev_separator = 1;
+		char padded[64];
+		for (size_t offset = 0; offset < size; offset += 64) {
+			const char* block = start + offset;
+			if (size - offset < 64) {
+				std::memset(padded, ' ', sizeof(padded));
+				std::memcpy(padded, block, size - offset);
+				block = padded;
+			}
+
+			block_masks masks;
+			classify(block, masks);
+
+			// Quotes after an odd run of backslashes are escaped, just like in parse_str
+			uint64_t escaped = masks.quote & escaped_bits(masks.backslash, prev_escape);
+
+			// Opening quotes are inside strings, closing quotes are not
+			uint64_t quotes = masks.quote & ~escaped;
+			uint64_t in_string = prefix_xor(quotes) ^ prev_in_string;
+			prev_in_string = (uint64_t) ((int64_t) in_string >> 63);
 
-	size_t bytes_read = 0;
-	while (stream && bytes_read < expected.size()) {
-		content[bytes_read] = stream.get();
+			uint64_t structural = masks.structural & ~in_string;
+			uint64_t separator = structural | (masks.space & ~in_string);
+			uint64_t primitive = ~(separator | in_string | masks.quote);
+			uint64_t starts = primitive & ((separator << 1) | prev_separator);
+			prev_separator = separator >> 63;
 
-		if (stream) {
-			bytes_read++;
+			uint64_t entries = structural | (quotes & in_string) | starts;
+			while (entries != 0) {
+				positions.push_back(offset + __builtin_ctzll(entries));
+				entries &= entries - 1;
+			}
+		}
+	}
+};
+
+// Calls visit with each structural character of [start, end) outside strings, classifying
+// 64 bytes at a time like the structural index, until it returns false. The input must
+// start outside a string
+template <typename Visit>
+static void for_each_structural(const char* start, const char* end, Visit&& visit) {
+	uint64_t prev_in_string = 0, prev_escape = 0;
+	char padded[64];
+	for (const char* block_start = start; block_start < end; block_start += 64) {
+		const char* block = block_start;
+		if (end - block_start < 64) {
+			std::memset(padded, ' ', sizeof(padded));
+			std::memcpy(padded, block, end - block_start);
+			block = padded;
+		}
+
+		block_masks masks;
+		classify(block, masks);
+		uint64_t escaped = masks.quote & escaped_bits(masks.backslash, prev_escape);
+		uint64_t in_string = prefix_xor(masks.quote & ~escaped) ^ prev_in_string;
+		prev_in_string = (uint64_t) ((int64_t) in_string >> 63);
+
+		uint64_t structural = masks.structural & ~in_string;
+		while (structural != 0) {
+			if (!visit(block_start + __builtin_ctzll(structural))) {
+				return;
+			}
+			structural &= structural - 1;
+		}
+	}
+}
+
+// Cursor over a contiguous buffer, which replaces the per-character std::istream
+// calls (and their sentries and locale lookups) with plain pointer arithmetic
+struct reader {
+	const char* begin;
+	const char* ptr;
+	const char* end;
+	structural_index index;
+	std::string decoded;	// Last string with escape sequences, decoded for the builder
+
+	reader(const char* data, size_t size) : begin(data), ptr(data), end(data + size) {}
+
+	bool eof() const {
+		return ptr == end;
+	}
+
+	size_t offset() const {
+		return ptr - begin;
+	}
+};
+
+static inline void skip_spaces(reader& input) {
+	if (input.eof() || !is_space(*input.ptr)) {
+		return;
+	}
+
+	// Single separators are cheaper to step over than to look up
+	input.ptr++;
+	if (input.eof() || !is_space(*input.ptr)) {
+		return;
+	}
+
+	// Every non-space byte after a space outside strings is indexed, so the
+	// next entry is where the current run of whitespace ends
+	structural_index& index = input.index;
+	while (true) {
+		if (index.base != nullptr && input.ptr < index.indexed_end) {
+			while (index.next < index.positions.size() && index.base + index.positions[index.next] < input.ptr) {
+				index.next++;
+			}
+			if (index.next < index.positions.size()) {
+				input.ptr = index.base + index.positions[index.next];
+				return;
+			}
+			input.ptr = index.indexed_end;
+		}
+
+		if (input.eof()) {
+			return;
 		}
+		index.build(input.ptr, input.end);
 	}
-	content.resize(bytes_read);
+}
+
+// Equivalent of `stream >> symbol`, returning false on EOF
+static inline bool parse_symbol(reader& input, char& symbol) {
+	skip_spaces(input);
+	if (input.eof()) {
+		return false;
+	}
+	symbol = *(input.ptr++);
+	return true;
+}
+
+// Equivalent of `stream >> symbol; stream.putback(symbol)`, with 0 on EOF
+static inline char peek_symbol(reader& input) {
+	skip_spaces(input);
+	return input.eof() ? 0 : *input.ptr;
+}
+
+static inline void parse_expect(reader& input, const std::string& expected) {
+	size_t bytes_read = std::min(expected.size(), (size_t) (input.end - input.ptr));
+	std::string content(input.ptr, bytes_read);
+	input.ptr += bytes_read;
 
 	if (content != expected) {
 		std::string msg = "Expected '" + expected + "', got ";
@@ -545,12 +2096,12 @@ static inline void parse_expect(std::istream& stream, std::string expected) {
 	}
 }
 
-static inline void parse_expect(std::istream& stream, char expected) {
+static inline void parse_expect(reader& input, char expected) {
 	char content = 0;
-	stream >> content;
+	bool found = parse_symbol(input, content);
 	if (content != expected) {
 		std::string msg = "Expected '" + std::string(1, expected) + "', got ";
-		if (!stream) {
+		if (!found) {
 			msg += "EOF";
 		} else {
 			msg += "byte " + std::to_string((int) content);
@@ -559,146 +2110,2934 @@ static inline void parse_expect(std::istream& stream, char expected) {
 	}
 }
 
-static std::string parse_str(std::istream& stream) {
-	parse_expect(stream, '"');
+// Closing quote of the string starting at ptr, or end when it is missing. Escape
+// sequences are kept as they are, so only the closing quote has to be found
+static const char* find_string_end(const char* ptr, const char* end) {
+	ptr = find_escape(ptr, end);
+	while (ptr != end && *ptr == '\\') {
+		if (end - ptr < 2) {
+			return end;
+		}
+		ptr = find_escape(ptr + 2, end);
+	}
+	return ptr;
+}
 
-	std::string content;
-	do {
-		content += stream.get();
-		if (!stream) {
-			throw json_exception{"Expected '\"', got EOF"};
+static uint32_t parse_hex(const char*& ptr, const char* end) {
+	uint32_t code = 0;
+	for (int i = 0; i < 4; i++) {
+		if (ptr == end) {
+			throw json_exception{"Expected hex digit, got EOF"};
 		}
-	} while (content.back() != '"' || (content.size() > 1 && content[content.size()-2] == '\\'));
-	content.pop_back();
 
-	return content;
+		char symbol = *(ptr++);
+		code <<= 4;
+		if (symbol >= '0' && symbol <= '9') {
+			code |= symbol - '0';
+		} else if ((symbol | 0x20) >= 'a' && (symbol | 0x20) <= 'f') {
+			code |= (symbol | 0x20) - 'a' + 10;
+		} else {
+			throw json_exception{"Expected hex digit, got byte " + std::to_string((int) symbol)};
+		}
+	}
+	return code;
 }
 
-static void parse_primitive(std::istream& stream, json& container) {
-	char symbol = 0;
-	stream >> symbol;
-	stream.putback(symbol);
-
-	if (symbol == 'n') {
-		parse_expect(stream, "null");
-		container.set_null();
-	} else if ((symbol >= '0' && symbol <= '9') || symbol == '-') {
-		double number;
-		stream >> number;
-		container.set_number(number);
-	} else if (symbol == 'f') {
-		parse_expect(stream, "false");
-		container.set_bool(false);
-	} else if (symbol == 't') {
-		parse_expect(stream, "true");
-		container.set_bool(true);
-	} else if (symbol == '"') {
-		container.set_string(parse_str(stream));
+static void append_utf8(std::string& out, uint32_t code) {
+	if (code < 0x80) {
+		out += (char) code;
+	} else if (code < 0x800) {
+		out += (char) (0xc0 | (code >> 6));
+		out += (char) (0x80 | (code & 0x3f));
+	} else if (code < 0x10000) {
+		out += (char) (0xe0 | (code >> 12));
+		out += (char) (0x80 | ((code >> 6) & 0x3f));
+		out += (char) (0x80 | (code & 0x3f));
 	} else {
-		throw json_exception{"Expected primitive, got byte " + std::to_string((int) symbol)};
+		out += (char) (0xf0 | (code >> 18));
+		out += (char) (0x80 | ((code >> 12) & 0x3f));
+		out += (char) (0x80 | ((code >> 6) & 0x3f));
+		out += (char) (0x80 | (code & 0x3f));
 	}
 }
 
-static void parse_json(std::istream&, json&);
-
-static void parse_list(std::istream& stream, json& container) {
-	char symbol = 0;
-	do {
-		json element;
-		parse_json(stream, element);
-		container.push_back(element);
+// Appends the text of the string contents [ptr, end), whose escape sequences are decoded
+// into UTF-8. Lone surrogates, which UTF-8 can't hold, become U+FFFD. On errors, ptr is left
+// past the bytes read
+static void decode_string(const char*& ptr, const char* end, std::string& out) {
+	for (;;) {
+		const char* escape = find_escape(ptr, end);
+		out.append(ptr, escape - ptr);
+		ptr = escape;
+		if (ptr == end) {
+			return;
+		}
 
-		stream >> symbol;
-	} while (stream && symbol == ',');
-	stream.putback(symbol);
+		// The contents end outside of an escape sequence, so one always follows a backslash
+		ptr++;
+		char symbol = *(ptr++);
+		if (symbol == '"' || symbol == '\\' || symbol == '/') {
+			out += symbol;
+		} else if (symbol == 'b') {
+			out += '\b';
+		} else if (symbol == 'f') {
+			out += '\f';
+		} else if (symbol == 'n') {
+			out += '\n';
+		} else if (symbol == 'r') {
+			out += '\r';
+		} else if (symbol == 't') {
+			out += '\t';
+		} else if (symbol == 'u') {
+			uint32_t code = parse_hex(ptr, end);
+			if (code >= 0xd800 && code < 0xdc00 && end - ptr >= 6 && ptr[0] == '\\' && ptr[1] == 'u') {
+				const char* low_start = ptr + 2;
+				uint32_t low = parse_hex(low_start, end);
+				if (low >= 0xdc00 && low < 0xe000) {
+					code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+					ptr = low_start;
+				}
+			}
+			if (code >= 0xd800 && code < 0xe000) {
+				code = 0xfffd;
+			}
+			append_utf8(out, code);
+		} else {
+			throw json_exception{"Expected escape sequence, got byte " + std::to_string((int) symbol)};
+		}
+	}
 }
 
-static void parse_dict(std::istream& stream, json& container) {
-	char symbol = 0;
-	do {
-		std::string key = parse_str(stream);
-		parse_expect(stream, ':');
+// Text of the string at the cursor. It points into the input unless the string has escape
+// sequences, in which case it is decoded into a buffer of the reader that the next call reuses
+static std::string_view parse_str_view(reader& input) {
+	parse_expect(input, '"');
 
-		json value;
-		parse_json(stream, value);
-		container.insert(std::pair<std::string, json>(key, value));
-
-		stream >> symbol;
-	} while (stream && symbol == ',');
-	stream.putback(symbol);
-}
+	const char* start = input.ptr;
+	const char* ptr = find_escape(start, input.end);
+	if (ptr != input.end && *ptr == '"') {
+		input.ptr = ptr + 1;
+		return std::string_view(start, ptr - start);
+	}
 
-static void parse_json(std::istream& stream, json& container) {
-	char symbol = 0;
-	stream >> symbol;
-	if (!stream) {
-		throw json_exception{"Expected JSON, got EOF"};
+	ptr = find_string_end(ptr, input.end);
+	if (ptr == input.end) {
+		input.ptr = input.end;
+		throw json_exception{"Expected '\"', got EOF"};
 	}
 
-	if (symbol == '[') {
-		container.set_list();
+	input.decoded.clear();
+	input.ptr = start;
+	decode_string(input.ptr, ptr, input.decoded);
+	input.ptr = ptr + 1;
+	return input.decoded;
+}
 
-		stream >> symbol;
-		stream.putback(symbol);
-		if (symbol != ']') {
-			parse_list(stream, container);
-		}
-		parse_expect(stream, ']');
-	} else if (symbol == '{') {
-		container.set_dictionary();
+struct number_result {
+	double value;
+	size_t size;
+};
 
-		stream >> symbol;
-		stream.putback(symbol);
-		if (symbol != '}') {
-			parse_dict(stream, container);
+static inline bool is_digit(char symbol) {
+	return symbol >= '0' && symbol <= '9';
+}
+
+static inline void expect_digit(const char* ptr, const char* end) {
+	if (ptr == end) {
+		throw json_exception{"Expected digit, got EOF"};
+	} else if (!is_digit(*ptr)) {
+		throw json_exception{"Expected digit, got byte " + std::to_string((int) *ptr)};
+	}
+}
+
+// Parses -?<Digits>(.<Digits>)?([eE][+-]?<Digits>)? at the start of [begin, end), returning
+// the correctly rounded value and the number of bytes it spans.
+// Up to 19 significant digits are accumulated in an integer, which covers integers and
+// short decimals exactly, and the rest is left to std::from_chars (Eisel-Lemire in libstdc++)
+static number_result parse_number(const char* begin, const char* end) {
+	static const double powers_of_ten[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const char* ptr = begin;
+	bool negative = ptr != end && *ptr == '-';
+	if (negative) {
+		ptr++;
+	}
+
+	uint64_t mantissa = 0;
+	int64_t exponent = 0;
+	int digits = 0;
+	bool truncated = false;
+
+	expect_digit(ptr, end);
+	for (; ptr != end && is_digit(*ptr); ptr++) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*ptr - '0');
+			digits += mantissa != 0;
+		} else {
+			exponent++;
+			truncated |= *ptr != '0';
+		}
+	}
+
+	if (ptr != end && *ptr == '.') {
+		expect_digit(++ptr, end);
+		for (; ptr != end && is_digit(*ptr); ptr++) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*ptr - '0');
+				digits += mantissa != 0;
+				exponent--;
+			} else {
+				truncated |= *ptr != '0';
+			}
+		}
+	}
+
+	if (ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+		ptr++;
+		bool negative_exponent = ptr != end && *ptr == '-';
+		if (ptr != end && (*ptr == '-' || *ptr == '+')) {
+			ptr++;
+		}
+
+		int64_t explicit_exponent = 0;
+		expect_digit(ptr, end);
+		for (; ptr != end && is_digit(*ptr); ptr++) {
+			if (explicit_exponent < 100000) {
+				explicit_exponent = explicit_exponent * 10 + (*ptr - '0');
+			}
+		}
+		exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+	}
+
+	double value;
+	if (!truncated && exponent == 0) {
+		value = (double) mantissa;
+	} else if (!truncated && mantissa <= ((uint64_t) 1 << 53) && exponent >= -22 && exponent <= 22) {
+		// Both operands are exact, so the single rounding of the operation is the correct one
+		value = exponent < 0 ? mantissa / powers_of_ten[-exponent] : mantissa * powers_of_ten[exponent];
+	} else {
+		auto result = std::from_chars(negative ? begin + 1 : begin, ptr, value);
+		if (result.ec == std::errc::result_out_of_range) {
+			if (digits + exponent > 0) {
+				throw json_exception{"Number out of range"};
+			}
+			value = 0;
+		}
+	}
+
+	return number_result{negative ? -value : value, (size_t) (ptr - begin)};
+}
+
+// Receives the values of a document as they are parsed, in order, without building it.
+// Strings and keys are only valid during the call
+struct json_handler {
+	virtual ~json_handler() = default;
+
+	virtual void on_null() {}
+	virtual void on_bool(bool) {}
+	virtual void on_number(double) {}
+	virtual void on_string(std::string_view) {}
+	virtual void on_key(std::string_view) {}
+	virtual void on_start_object() {}
+	virtual void on_end_object() {}
+	virtual void on_start_array() {}
+	virtual void on_end_array() {}
+};
+
+// Builds a document in place, each value right where it belongs in its container
+struct document_builder {
+	json* value;
+	std::vector<json_impl*>& open;
+
+	void null() {}
+
+	void boolean(bool boolean) {
+		value->set_bool(boolean);
+	}
+
+	void number(double number) {
+		value->set_number(number);
+	}
+
+	void string(std::string_view text) {
+		json_node(*value).make_string() = text;
+	}
+
+	// The value is always null here, so it can be made a list or a dictionary without
+	// clearing it, which would give up the arena of the document
+	void start_list() {
+		json_impl& node = json_node(*value);
+		node.make_list();
+		open.push_back(&node);
+	}
+
+	void start_dict() {
+		json_impl& node = json_node(*value);
+		node.make_dict();
+		open.push_back(&node);
+	}
+
+	void item() {
+		value = &open.back()->append_item();
+	}
+
+	// Documents are always parsed into an arena, which keeps the key straight from the input
+	void key(std::string_view name) {
+		json_impl& dict = *open.back();
+		value = &dict.append(dict.owner()->keep(name), dict.create())->value;
+	}
+
+	void end_list() {
+		open.pop_back();
+	}
+
+	void end_dict() {
+		open.pop_back();
+	}
+};
+
+struct event_builder {
+	json_handler& handler;
+
+	void null() {
+		handler.on_null();
+	}
+
+	void boolean(bool boolean) {
+		handler.on_bool(boolean);
+	}
+
+	void number(double number) {
+		handler.on_number(number);
+	}
+
+	void string(std::string_view text) {
+		handler.on_string(text);
+	}
+
+	void start_list() {
+		handler.on_start_array();
+	}
+
+	void start_dict() {
+		handler.on_start_object();
+	}
+
+	void item() {}
+
+	void key(std::string_view name) {
+		handler.on_key(name);
+	}
+
+	void end_list() {
+		handler.on_end_array();
+	}
+
+	void end_dict() {
+		handler.on_end_object();
+	}
+};
+
+template <typename Builder>
+static void parse_primitive(reader& input, Builder& builder) {
+	char symbol = peek_symbol(input);
+
+	if (symbol == 'n') {
+		parse_expect(input, "null");
+		builder.null();
+	} else if ((symbol >= '0' && symbol <= '9') || symbol == '-') {
+		number_result number = parse_number(input.ptr, input.end);
+		input.ptr += number.size;
+		builder.number(number.value);
+	} else if (symbol == 'f') {
+		parse_expect(input, "false");
+		builder.boolean(false);
+	} else if (symbol == 't') {
+		parse_expect(input, "true");
+		builder.boolean(true);
+	} else if (symbol == '"') {
+		builder.string(parse_str_view(input));
+	} else {
+		throw json_exception{"Expected primitive, got byte " + std::to_string((int) symbol)};
+	}
+}
+
+// Deepest nesting of lists and dictionaries accepted by default
+static constexpr size_t DEFAULT_MAX_DEPTH = 1024;
+
+// Whether [ptr, end) holds the whole token starting at ptr, which is only in doubt
+// when the token may go on past end. Scanned is how much of the token is already
+// known not to end it, so that a token cut again and again is only looked at once
+static bool is_complete(const char* ptr, const char* end, size_t& scanned) {
+	char symbol = *ptr;
+	const char* cursor = ptr + scanned;
+	if (symbol == '"') {
+		// An escape cut after its backslash is looked at again along with what follows
+		cursor = find_escape(std::max(cursor, ptr + 1), end);
+		while (cursor != end && *cursor == '\\') {
+			if (end - cursor < 2) {
+				scanned = cursor - ptr;
+				return false;
+			}
+			cursor = find_escape(cursor + 2, end);
+		}
+	} else if (symbol == '-' || is_digit(symbol)) {
+		while (cursor != end && (is_digit(*cursor) || *cursor == '.' || *cursor == 'e' || *cursor == 'E' || *cursor == '+' || *cursor == '-')) {
+			cursor++;
+		}
+	} else if (symbol == 'n' || symbol == 't') {
+		return end - ptr >= 4;
+	} else if (symbol == 'f') {
+		return end - ptr >= 5;
+	} else {
+		return true;
+	}
+
+	if (cursor == end) {
+		scanned = cursor - ptr;
+		return false;
+	}
+	scanned = 0;
+	return true;
+}
+
+// Where the parser stands, always between two tokens
+enum parse_state {
+	PARSE_VALUE,
+	PARSE_FIRST_ITEM,
+	PARSE_FIRST_KEY,
+	PARSE_KEY,
+	PARSE_COLON,
+	PARSE_NEXT,
+	PARSE_END
+};
+
+// Parses values without recursion, keeping whether each container still open is a list
+// on a stack. Since its whole state lies here, it can stop before a token cut by the end
+// of the input and carry on once the rest of the input arrives
+template <typename Builder>
+struct parser {
+	Builder& builder;
+	std::vector<bool>& open;
+	size_t max_depth;
+	parse_state state = PARSE_VALUE;
+
+	// Containers opened before the input, which it may end inside of
+	size_t outer = 0;
+
+	// How much of a token cut by the end of the input was scanned, as it is kept at the
+	// start of the input until the rest of it arrives
+	size_t scanned = 0;
+
+	// Parses up to the end of the input, or when more input may follow, up to its last
+	// complete token, leaving the cursor before the rest
+	void run(reader& input, bool last) {
+		for (;;) {
+			skip_spaces(input);
+			if (input.eof()) {
+				if (last) {
+					parse_eof(input);
+				}
+				return;
+			}
+
+			char symbol = *input.ptr;
+			if (state == PARSE_VALUE) {
+				if (symbol == '[' || symbol == '{') {
+					open_container(input, symbol == '[');
+				} else if (last || is_complete(input.ptr, input.end, scanned)) {
+					parse_primitive(input, builder);
+					close_value();
+				} else {
+					return;
+				}
+			} else if (state == PARSE_NEXT) {
+				if (symbol == ',') {
+					input.ptr++;
+					if (open.back()) {
+						builder.item();
+						state = PARSE_VALUE;
+					} else {
+						state = PARSE_KEY;
+					}
+				} else {
+					parse_expect(input, open.back() ? ']' : '}');
+					close_container();
+				}
+			} else if (state == PARSE_FIRST_ITEM) {
+				if (symbol == ']') {
+					input.ptr++;
+					close_container();
+				} else {
+					builder.item();
+					state = PARSE_VALUE;
+				}
+			} else if (state == PARSE_FIRST_KEY && symbol == '}') {
+				input.ptr++;
+				close_container();
+			} else if (state == PARSE_FIRST_KEY || state == PARSE_KEY) {
+				if (!last && symbol == '"' && !is_complete(input.ptr, input.end, scanned)) {
+					return;
+				}
+				builder.key(parse_str_view(input));
+				state = PARSE_COLON;
+			} else if (state == PARSE_COLON) {
+				parse_expect(input, ':');
+				state = PARSE_VALUE;
+			} else {
+				input.ptr++;
+				throw json_exception{"Expected EOF, got byte " + std::to_string((int) symbol)};
+			}
+		}
+	}
+
+	void parse_eof(reader& input) {
+		if (state == PARSE_VALUE || state == PARSE_FIRST_ITEM) {
+			throw json_exception{"Expected JSON, got EOF"};
+		} else if (state == PARSE_FIRST_KEY || state == PARSE_KEY) {
+			parse_expect(input, '"');
+		} else if (state == PARSE_COLON) {
+			parse_expect(input, ':');
+		} else if (state == PARSE_NEXT && open.size() > outer) {
+			parse_expect(input, open.back() ? ']' : '}');
+		}
+	}
+
+	void open_container(reader& input, bool is_list) {
+		input.ptr++;
+		if (open.size() == max_depth) {
+			throw json_exception{"Depth " + std::to_string(open.size() + 1) + " out of range"};
+		}
+
+		open.push_back(is_list);
+		if (is_list) {
+			builder.start_list();
+			state = PARSE_FIRST_ITEM;
+		} else {
+			builder.start_dict();
+			state = PARSE_FIRST_KEY;
+		}
+	}
+
+	void close_container() {
+		bool is_list = open.back();
+		open.pop_back();
+		if (is_list) {
+			builder.end_list();
+		} else {
+			builder.end_dict();
+		}
+		close_value();
+	}
+
+	void close_value() {
+		state = open.empty() ? PARSE_END : PARSE_NEXT;
+	}
+};
+
+// Parsing errors also carry the offset of the input where they were detected
+struct json_parse_exception : json_exception {
+	size_t offset;
+};
+
+// Stack that the parses of a thread reuse from one document to the next. A parse holds it
+// until it returns, so that a parse started by a handler of another one gets a new stack
+template <typename T>
+struct reused_stack {
+	std::vector<T> items;
+
+	reused_stack() {
+		items.swap(spare());
+		items.clear();
+	}
+
+	~reused_stack() {
+		items.swap(spare());
+	}
+
+	static std::vector<T>& spare() {
+		static thread_local std::vector<T> cached;
+		return cached;
+	}
+};
+
+// Parses a whole document
+template <typename Builder>
+static void parse_all(reader& input, Builder& builder, size_t max_depth) {
+	reused_stack<bool> open;
+	parser<Builder> machine{builder, open.items, max_depth};
+	try {
+		machine.run(input, true);
+	} catch (const json_exception& e) {
+		throw json_parse_exception{{e.msg}, input.offset()};
+	}
+}
+
+static void parse_document(reader& input, json& container, size_t max_depth, bool intern_keys = false) {
+	reused_stack<json_impl*> open;
+	json_impl::start_document(container, intern_keys);
+	document_builder builder{&container, open.items};
+	parse_all(input, builder, max_depth);
+}
+
+// Interning keeps each key of the document only once, shared by all of its dictionaries,
+// which pays off for arrays of records with the same keys
+json json_parse(const char* data, size_t size, size_t max_depth = DEFAULT_MAX_DEPTH, bool intern_keys = false) {
+	reader input(data, size);
+	json container;
+	parse_document(input, container, max_depth, intern_keys);
+	return container;
+}
+
+json json_parse(std::string_view text, size_t max_depth = DEFAULT_MAX_DEPTH, bool intern_keys = false) {
+	return json_parse(text.data(), text.size(), max_depth, intern_keys);
+}
+
+void json_parse(const char* data, size_t size, json_handler& handler, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	reader input(data, size);
+	event_builder builder{handler};
+	parse_all(input, builder, max_depth);
+}
+
+void json_parse(std::string_view text, json_handler& handler, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	json_parse(text.data(), text.size(), handler, max_depth);
+}
+
+// Parses a document arriving in pieces into a json or a handler, each piece as soon as it
+// is fed. Only a token cut between two pieces is kept, until the rest of it arrives
+struct json_push_parser {
+	json_push_parser(json& document, size_t max_depth = DEFAULT_MAX_DEPTH)
+		: machine(new document_machine(document, max_depth)) {}
+
+	json_push_parser(json_handler& handler, size_t max_depth = DEFAULT_MAX_DEPTH)
+		: machine(new event_machine(handler, max_depth)) {}
+
+	void feed(const char* data, size_t size) {
+		parse(data, size, false);
+	}
+
+	// Parses what is left, failing if the document is incomplete
+	void finish() {
+		parse(nullptr, 0, true);
+	}
+
+	private:
+		struct state_machine {
+			virtual ~state_machine() = default;
+			virtual void run(reader& input, bool last) = 0;
+		};
+
+		struct document_machine : state_machine {
+			std::vector<json_impl*> containers;
+			std::vector<bool> open;
+			document_builder builder;
+			parser<document_builder> core;
+
+			document_machine(json& document, size_t max_depth)
+				: builder{&document, containers}, core{builder, open, max_depth} {
+				json_impl::start_document(document);
+			}
+
+			void run(reader& input, bool last) override {
+				core.run(input, last);
+			}
+		};
+
+		struct event_machine : state_machine {
+			std::vector<bool> open;
+			event_builder builder;
+			parser<event_builder> core;
+
+			event_machine(json_handler& handler, size_t max_depth)
+				: builder{handler}, core{builder, open, max_depth} {}
+
+			void run(reader& input, bool last) override {
+				core.run(input, last);
+			}
+		};
+
+		std::unique_ptr<state_machine> machine;
+		std::string pending;
+		size_t position = 0;
+
+		void parse(const char* data, size_t size, bool last) {
+			// A cut token is completed from the next piece a little at a time, so that
+			// the pieces themselves are parsed where they are rather than copied
+			while (!pending.empty() && (size > 0 || last)) {
+				size_t count = std::min(size, std::max(pending.size(), (size_t) 256));
+				pending.append(data, count);
+				data += count;
+				size -= count;
+
+				reader input(pending.data(), pending.size());
+				run(input, last && size == 0);
+				pending.erase(0, input.offset());
+			}
+			if (!pending.empty() || (size == 0 && !last)) {
+				return;
+			}
+
+			reader input(data, size);
+			run(input, last);
+			pending.assign(input.ptr, input.end);
+		}
+
+		void run(reader& input, bool last) {
+			try {
+				machine->run(input, last);
+			} catch (const json_exception& e) {
+				throw json_parse_exception{{e.msg}, position + input.offset()};
+			}
+			position += input.offset();
+		}
+};
+
+// Read-only view of a whole file, mapped in memory when it is a regular file
+// so that it is parsed straight from the page cache
+struct mapped_file {
+	const char* data = nullptr;
+	size_t size = 0;
+
+	// Advice is how the mapping will be read, through madvise
+	mapped_file(const std::string& path, int advice = MADV_SEQUENTIAL) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw json_exception{"Unable to open '" + path + "'"};
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) < 0) {
+			close(fd);
+			throw json_exception{"Unable to open '" + path + "'"};
+		}
+
+		if (!S_ISREG(info.st_mode)) {
+			char chunk[1 << 16];
+			ssize_t bytes_read;
+			while ((bytes_read = read(fd, chunk, sizeof(chunk))) > 0) {
+				buffer.append(chunk, bytes_read);
+			}
+			close(fd);
+			if (bytes_read < 0) {
+				throw json_exception{"Unable to read '" + path + "'"};
+			}
+			data = buffer.data();
+			size = buffer.size();
+			return;
+		}
+
+		size = info.st_size;
+		if (size > 0) {
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) {
+				close(fd);
+				throw json_exception{"Unable to map '" + path + "'"};
+			}
+			madvise(mapping, size, advice);
+			mapped = true;
+			data = (const char*) mapping;
+		}
+		close(fd);
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	~mapped_file() {
+		if (mapped) {
+			munmap((void*) data, size);
+		}
+	}
+
+	private:
+		bool mapped = false;
+		std::string buffer;
+};
+
+json json_load_file(const std::string& path, size_t max_depth = DEFAULT_MAX_DEPTH, bool intern_keys = false) {
+	mapped_file file(path);
+	return json_parse(file.data, file.size, max_depth, intern_keys);
+}
+
+void json_load_file(const std::string& path, json_handler& handler, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	mapped_file file(path);
+	json_parse(file.data, file.size, handler, max_depth);
+}
+
+// Parses the document on the next line of newline-delimited JSON, skipping blank lines, and
+// moves position past it. Returns false when no document is left, and its offset otherwise
+static bool parse_line(const char* data, size_t size, size_t& position, json& value, size_t& start, size_t max_depth) {
+	while (position < size) {
+		const char* line = data + position;
+		const char* newline = (const char*) std::memchr(line, '\n', size - position);
+		size_t length = newline ? newline - line : size - position;
+		size_t line_start = position;
+		position += newline ? length + 1 : length;
+
+		reader input(line, length);
+		skip_spaces(input);
+		if (input.eof()) {
+			continue;
+		}
+
+		start = line_start + input.offset();
+		try {
+			parse_document(input, value, max_depth);
+		} catch (const json_parse_exception& e) {
+			throw json_parse_exception{{e.msg}, line_start + e.offset};
+		}
+		return true;
+	}
+	return false;
+}
+
+// Reads newline-delimited JSON one document at a time. Parsing errors carry the offset
+// in the whole input
+struct json_lines {
+	json_lines(const char* text, size_t length, size_t depth = DEFAULT_MAX_DEPTH)
+		: data(text), size(length), max_depth(depth) {}
+
+	json_lines(std::string_view text, size_t depth = DEFAULT_MAX_DEPTH)
+		: json_lines(text.data(), text.size(), depth) {}
+
+	// Parses the next document into value, returning false once they are all read
+	bool next(json& value) {
+		return parse_line(data, size, position, value, start, max_depth);
+	}
+
+	// Offset of the last document read
+	size_t offset() const {
+		return start;
+	}
+
+	private:
+		const char* data;
+		size_t size;
+		size_t max_depth;
+		size_t position = 0;
+		size_t start = 0;
+};
+
+// Receives each document of newline-delimited JSON with its offset in the input
+using json_line_visitor = std::function<void(size_t offset, json& value)>;
+
+// Parses chunks of lines on a pool of threads. Each chunk starts right after a newline, so
+// that every line belongs to exactly one of them
+struct line_pool {
+	static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+	struct chunk {
+		std::vector<std::pair<size_t, json>> values;
+		std::exception_ptr error;
+		bool done = false;
+	};
+
+	const char* data;
+	size_t size;
+	const json_line_visitor& visit;
+	bool ordered;
+	size_t max_depth;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<chunk> chunks;
+	std::vector<std::thread> workers;
+	size_t next = 0;
+	size_t completed = 0;
+	size_t delivered = 0;
+	bool failed = false;
+	std::exception_ptr error;
+
+	line_pool(const char* text, size_t length, const json_line_visitor& visitor, size_t threads, bool in_order, size_t depth)
+		: data(text), size(length), visit(visitor), ordered(in_order), max_depth(depth),
+		  chunks((length + CHUNK_SIZE - 1) / CHUNK_SIZE) {
+		for (size_t i = 0; i < threads; i++) {
+			workers.emplace_back([this, threads] { work(2 * threads); });
+		}
+	}
+
+	~line_pool() {
+		stop();
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			failed = true;
+		}
+		changed.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+	}
+
+	size_t boundary(size_t index) const {
+		size_t position = std::min(index * CHUNK_SIZE, size);
+		if (position == 0 || position == size) {
+			return position;
+		}
+		const char* newline = (const char*) std::memchr(data + position - 1, '\n', size - position + 1);
+		return newline ? newline - data + 1 : size;
+	}
+
+	// In order, a chunk is only taken while few enough are waiting to be delivered, which
+	// bounds the documents held at once
+	void work(size_t window) {
+		for (;;) {
+			size_t index;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return failed || next == chunks.size() || !ordered || next < delivered + window; });
+				if (failed || next == chunks.size()) {
+					return;
+				}
+				index = next++;
+			}
+
+			chunk result;
+			try {
+				size_t position = boundary(index), end = boundary(index + 1), start;
+				json value;
+				while (parse_line(data, end, position, value, start, max_depth)) {
+					if (ordered) {
+						result.values.emplace_back(start, std::move(value));
+					} else {
+						visit(start, value);
+					}
+				}
+			} catch (...) {
+				result.error = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (result.error && !ordered) {
+					failed = true;
+					error = result.error;
+				}
+				result.done = true;
+				chunks[index] = std::move(result);
+				completed++;
+			}
+			changed.notify_all();
+		}
+	}
+
+	// Delivers the documents of each chunk on the calling thread, in order, as soon as
+	// the chunk is done
+	void deliver() {
+		for (size_t index = 0; index < chunks.size(); index++) {
+			chunk result;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return chunks[index].done; });
+				result = std::move(chunks[index]);
+			}
+
+			for (auto& [start, value] : result.values) {
+				visit(start, value);
+			}
+			if (result.error) {
+				std::rethrow_exception(result.error);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				delivered++;
+			}
+			changed.notify_all();
+		}
+	}
+
+	// Waits for the chunks to be parsed when their documents are delivered by the threads
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return failed || completed == chunks.size(); });
+	}
+};
+
+// Parses every document of newline-delimited JSON, skipping blank lines. With more than one
+// thread, chunks of lines are parsed in parallel, and their documents are either delivered
+// in order on the calling thread, or unordered on the threads that parse them, possibly at
+// the same time. A parsing error stops parsing, after every document before it when in order
+void json_parse_lines(const char* data, size_t size, const json_line_visitor& visit, size_t threads = 1, bool ordered = true, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	// A thread more than there are chunks would have nothing to parse
+	threads = std::min(threads, (size + line_pool::CHUNK_SIZE - 1) / line_pool::CHUNK_SIZE);
+	if (threads <= 1) {
+		json_lines lines(data, size, max_depth);
+		json value;
+		while (lines.next(value)) {
+			visit(lines.offset(), value);
+		}
+		return;
+	}
+
+	line_pool pool(data, size, visit, threads, ordered, max_depth);
+	if (ordered) {
+		pool.deliver();
+	} else {
+		pool.wait();
+	}
+	pool.stop();
+	if (pool.error) {
+		std::rethrow_exception(pool.error);
+	}
+}
+
+void json_parse_lines(std::string_view text, const json_line_visitor& visit, size_t threads = 1, bool ordered = true, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	json_parse_lines(text.data(), text.size(), visit, threads, ordered, max_depth);
+}
+
+void json_load_lines(const std::string& path, const json_line_visitor& visit, size_t threads = 1, bool ordered = true, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	mapped_file file(path);
+	json_parse_lines(file.data, file.size, visit, threads, ordered, max_depth);
+}
+
+// Runs task(0) ... task(count - 1) on as many threads, the calling one included, each of
+// them taking the next index as soon as it is done with the previous one, so that uneven
+// tasks still keep them all busy. The first error stops them and is rethrown
+static void parallel_for(size_t threads, size_t count, const std::function<void(size_t)>& task) {
+	std::atomic<size_t> next{0};
+	std::atomic<bool> failed{false};
+	std::exception_ptr error;
+	std::mutex mutex;
+
+	auto work = [&] {
+		size_t index;
+		while (!failed && (index = next++) < count) {
+			try {
+				task(index);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!failed) {
+					error = std::current_exception();
+					failed = true;
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < std::min(threads, count); i++) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// Elements of a top-level list split into groups of consecutive ones, of about GROUP_SIZE
+// bytes each, found from the structural characters alone without parsing anything
+struct list_split {
+	static constexpr size_t GROUP_SIZE = 1 << 20;
+
+	struct group {
+		size_t begin;
+		size_t end;
+		size_t first;
+		size_t count;
+	};
+
+	std::vector<group> groups;
+	size_t count = 0;
+
+	// Position of the bracket closing the list, or the size of the input when it is missing
+	size_t close;
+
+	list_split(const char* data, size_t size, size_t start) : close(size) {
+		size_t depth = 1, begin = start, commas = 0;
+		for_each_structural(data + start, data + size, [&](const char* ptr) {
+			size_t position = ptr - data;
+			if (*ptr == '[' || *ptr == '{') {
+				depth++;
+			} else if (*ptr == ']' || *ptr == '}') {
+				if (--depth == 0) {
+					groups.push_back(group{begin, position, count, commas + 1});
+					count += commas + 1;
+					close = position;
+					return false;
+				}
+			} else if (*ptr == ',' && depth == 1) {
+				commas++;
+				if (position - begin >= GROUP_SIZE) {
+					groups.push_back(group{begin, position, count, commas});
+					count += commas;
+					commas = 0;
+					begin = position + 1;
+				}
+			}
+			return true;
+		});
+	}
+};
+
+// Parses the elements of a group as those of a list opened before them, into a document
+// of their own
+static json parse_group(const char* data, const list_split::group& range, size_t max_depth) {
+	json group;
+	json_impl::start_document(group);
+
+	std::vector<json_impl*> containers;
+	std::vector<bool> open;
+	document_builder builder{&group, containers};
+	parser<document_builder> machine{builder, open, max_depth};
+
+	builder.start_list();
+	builder.item();
+	open.push_back(true);
+	machine.outer = 1;
+
+	reader input(data + range.begin, range.end - range.begin);
+	machine.run(input, true);
+	if (machine.state != PARSE_NEXT || open.size() != 1 || json_size(group) != range.count) {
+		throw json_exception{"Unexpected end of group"};
+	}
+	return group;
+}
+
+// Parses a document whose top level is a large list on several threads. Its elements are
+// split into groups by a quick scan, and each group is parsed into a document of its own,
+// whose values are then moved into their slots of the list, made with its final size.
+// Other documents are parsed as usual, as are invalid ones, so that errors are the same
+json json_parse_parallel(const char* data, size_t size, size_t threads, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	reader input(data, size);
+	skip_spaces(input);
+	if (threads <= 1 || max_depth == 0 || input.eof() || *input.ptr != '[') {
+		return json_parse(data, size, max_depth);
+	}
+
+	size_t start = input.offset() + 1;
+	input.ptr++;
+	skip_spaces(input);
+	if (input.eof() || *input.ptr == ']') {
+		return json_parse(data, size, max_depth);
+	}
+
+	list_split split(data, size, start);
+	reader rest(data + split.close, size - split.close);
+	if (!rest.eof() && *rest.ptr == ']') {
+		rest.ptr++;
+		skip_spaces(rest);
+	}
+	if (split.close == size || data[split.close] != ']' || !rest.eof()) {
+		return json_parse(data, size, max_depth);
+	}
+
+	json result;
+	result.set_list();
+	json_reserve(result, split.count);
+	json_impl& slots = json_node(result);
+	for (size_t i = 0; i < split.count; i++) {
+		slots.append_item(nullptr);
+	}
+
+	try {
+		parallel_for(threads, split.groups.size(), [&](size_t index) {
+			const list_split::group& range = split.groups[index];
+			json group = parse_group(data, range, max_depth);
+			json* values = json_node(group).l->items;
+			for (size_t i = 0; i < range.count; i++) {
+				slots.l->items[range.first + i] = std::move(values[i]);
+			}
+		});
+	} catch (const json_exception&) {
+		return json_parse(data, size, max_depth);
+	}
+	return result;
+}
+
+json json_parse_parallel(std::string_view text, size_t threads, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	return json_parse_parallel(text.data(), text.size(), threads, max_depth);
+}
+
+json json_load_file_parallel(const std::string& path, size_t threads, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	mapped_file file(path);
+	return json_parse_parallel(file.data, file.size, threads, max_depth);
+}
+
+// Views only look at a few tokens at a time, which is not worth indexing whitespace for
+static const char* skip_view_spaces(const char* ptr, const char* end) {
+	while (ptr != end && is_space(*ptr)) {
+		ptr++;
+	}
+	return ptr;
+}
+
+static const char* expect_view(const char* ptr, const char* end, char expected) {
+	ptr = skip_view_spaces(ptr, end);
+	if (ptr == end || *ptr != expected) {
+		std::string msg = "Expected '" + std::string(1, expected) + "', got ";
+		if (ptr == end) {
+			msg += "EOF";
+		} else {
+			msg += "byte " + std::to_string((int) *ptr);
+		}
+		throw json_exception{msg};
+	}
+	return ptr + 1;
+}
+
+// Closing quote of the string whose opening quote is at ptr
+static const char* view_string_end(const char* ptr, const char* end) {
+	ptr = find_string_end(ptr + 1, end);
+	if (ptr == end) {
+		throw json_exception{"Expected '\"', got EOF"};
+	}
+	return ptr;
+}
+
+// Text of the string between ptr and its closing quote, pointing into the input unless
+// it has to be decoded into buffer
+static std::string_view view_text(const char* ptr, const char* close, std::string& buffer) {
+	ptr++;
+	if (std::memchr(ptr, '\\', close - ptr) == nullptr) {
+		return std::string_view(ptr, close - ptr);
+	}
+	buffer.clear();
+	decode_string(ptr, close, buffer);
+	return buffer;
+}
+
+// End of the value starting at ptr, whose containers are only bracket-matched
+static const char* skip_view_value(const char* ptr, const char* end) {
+	if (*ptr == '[' || *ptr == '{') {
+		char close = *ptr == '[' ? ']' : '}';
+		const char* last = nullptr;
+		size_t depth = 0;
+		for_each_structural(ptr, end, [&](const char* position) {
+			if (*position == '[' || *position == '{') {
+				depth++;
+			} else if ((*position == ']' || *position == '}') && --depth == 0) {
+				last = position;
+				return false;
+			}
+			return true;
+		});
+		if (last == nullptr) {
+			throw json_exception{"Expected '" + std::string(1, close) + "', got EOF"};
+		}
+		return last + 1;
+	} else if (*ptr == '"') {
+		return view_string_end(ptr, end) + 1;
+	}
+
+	while (ptr != end && !is_space(*ptr) && *ptr != ',' && *ptr != ']' && *ptr != '}') {
+		ptr++;
+	}
+	return ptr;
+}
+
+// Read-only view of a value in a buffer, which is only parsed as far as it is accessed.
+// Finding a key or an element steps over the values before it by matching their brackets,
+// so they are neither built nor checked. The buffer must outlive the view
+struct json_view {
+	struct list_iterator;
+	struct dictionary_iterator;
+
+	json_view(const char* data, size_t size) : json_view(skip_view_spaces(data, data + size), data + size, 0) {
+		if (ptr == end) {
+			throw json_exception{"Expected JSON, got EOF"};
+		}
+	}
+
+	json_view(std::string_view text) : json_view(text.data(), text.size()) {}
+
+	bool is_list() const {
+		return *ptr == '[';
+	}
+
+	bool is_dictionary() const {
+		return *ptr == '{';
+	}
+
+	bool is_string() const {
+		return *ptr == '"';
+	}
+
+	bool is_number() const {
+		return *ptr == '-' || is_digit(*ptr);
+	}
+
+	bool is_bool() const {
+		return *ptr == 't' || *ptr == 'f';
+	}
+
+	bool is_null() const {
+		return *ptr == 'n';
+	}
+
+	json_view operator[](std::string_view key) const;
+	json_view at(size_t index) const;
+
+	list_iterator begin_list() const;
+	list_iterator end_list() const;
+
+	dictionary_iterator begin_dictionary() const;
+	dictionary_iterator end_dictionary() const;
+
+	double get_number() const {
+		if (!is_number()) {
+			throw json_exception{"Wrong json_view type for get_number"};
+		}
+		return parse_number(ptr, end).value;
+	}
+
+	bool get_bool() const {
+		if (!is_bool()) {
+			throw json_exception{"Wrong json_view type for get_bool"};
+		}
+		reader input(ptr, end - ptr);
+		parse_expect(input, *ptr == 't' ? "true" : "false");
+		return *ptr == 't';
+	}
+
+	// Text of the string, decoded like in a json
+	std::string get_string() const {
+		if (!is_string()) {
+			throw json_exception{"Wrong json_view type for get_string"};
+		}
+		std::string buffer;
+		return std::string(view_text(ptr, view_string_end(ptr, end), buffer));
+	}
+
+	// Parses the whole value
+	json to_json() const {
+		return json_parse(ptr, skip_view_value(ptr, end) - ptr);
+	}
+
+	private:
+		const char* ptr;
+		const char* end;
+
+		json_view(const char* value, const char* last, int) : ptr(value), end(last) {}
+};
+
+struct json_view::list_iterator {
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = json_view;
+	using difference_type = std::ptrdiff_t;
+	using reference = json_view;
+
+	struct pointer {
+		reference element;
+
+		const reference* operator->() const {
+			return &element;
+		}
+	};
+
+	// The cursor is null past the last element, so that the end is known without looking for it
+	list_iterator(const char* element = nullptr, const char* last = nullptr) : ptr(element), end(last) {}
+
+	reference operator*() const {
+		return json_view(ptr, end, 0);
+	}
+
+	pointer operator->() const {
+		return pointer{**this};
+	}
+
+	list_iterator& operator++() {
+		const char* next = skip_view_spaces(skip_view_value(ptr, end), end);
+		if (next != end && *next == ',') {
+			ptr = skip_view_spaces(next + 1, end);
+			if (ptr == end) {
+				throw json_exception{"Expected JSON, got EOF"};
+			}
+		} else {
+			expect_view(next, end, ']');
+			ptr = nullptr;
+		}
+		return *this;
+	}
+
+	list_iterator operator++(int) {
+		list_iterator it(ptr, end);
+		++(*this);
+		return it;
+	}
+
+	bool operator==(const list_iterator& rhs) const {
+		return ptr == rhs.ptr;
+	}
+
+	bool operator!=(const list_iterator& rhs) const {
+		return ptr != rhs.ptr;
+	}
+
+	explicit operator bool() const {
+		return ptr != nullptr;
+	}
+
+	private:
+		const char* ptr;
+		const char* end;
+};
+
+struct json_view::dictionary_iterator {
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = std::pair<std::string_view, json_view>;
+	using difference_type = std::ptrdiff_t;
+	using reference = value_type;
+
+	struct pointer {
+		reference pair;
+
+		const reference* operator->() const {
+			return &pair;
+		}
+	};
+
+	// The cursor is at the opening quote of the key, and null past the last one
+	dictionary_iterator(const char* key = nullptr, const char* last = nullptr) : ptr(key), end(last) {}
+
+	// Keys with escape sequences are decoded into the iterator, and last until it moves
+	reference operator*() const {
+		const char* key_end = view_string_end(ptr, end);
+		const char* value = skip_view_spaces(expect_view(key_end + 1, end, ':'), end);
+		if (value == end) {
+			throw json_exception{"Expected JSON, got EOF"};
+		}
+		return reference(view_text(ptr, key_end, decoded), json_view(value, end, 0));
+	}
+
+	pointer operator->() const {
+		return pointer{**this};
+	}
+
+	dictionary_iterator& operator++() {
+		json_view value = (**this).second;
+		const char* next = skip_view_spaces(skip_view_value(value.ptr, end), end);
+		if (next != end && *next == ',') {
+			ptr = skip_view_spaces(next + 1, end);
+			if (ptr == end || *ptr != '"') {
+				expect_view(ptr, end, '"');
+			}
+		} else {
+			expect_view(next, end, '}');
+			ptr = nullptr;
+		}
+		return *this;
+	}
+
+	dictionary_iterator operator++(int) {
+		dictionary_iterator it(ptr, end);
+		++(*this);
+		return it;
+	}
+
+	bool operator==(const dictionary_iterator& rhs) const {
+		return ptr == rhs.ptr;
+	}
+
+	bool operator!=(const dictionary_iterator& rhs) const {
+		return ptr != rhs.ptr;
+	}
+
+	explicit operator bool() const {
+		return ptr != nullptr;
+	}
+
+	private:
+		const char* ptr;
+		const char* end;
+		mutable std::string decoded;
+};
+
+json_view::list_iterator json_view::begin_list() const {
+	if (!is_list()) {
+		throw json_exception{"Wrong json_view type for begin_list"};
+	}
+
+	const char* first = skip_view_spaces(ptr + 1, end);
+	if (first != end && *first == ']') {
+		return list_iterator();
+	} else if (first == end) {
+		throw json_exception{"Expected JSON, got EOF"};
+	}
+	return list_iterator(first, end);
+}
+
+json_view::list_iterator json_view::end_list() const {
+	if (!is_list()) {
+		throw json_exception{"Wrong json_view type for end_list"};
+	}
+	return list_iterator();
+}
+
+json_view::dictionary_iterator json_view::begin_dictionary() const {
+	if (!is_dictionary()) {
+		throw json_exception{"Wrong json_view type for begin_dictionary"};
+	}
+
+	const char* first = skip_view_spaces(ptr + 1, end);
+	if (first != end && *first == '}') {
+		return dictionary_iterator();
+	}
+	expect_view(first, end, '"');
+	return dictionary_iterator(first, end);
+}
+
+json_view::dictionary_iterator json_view::end_dictionary() const {
+	if (!is_dictionary()) {
+		throw json_exception{"Wrong json_view type for end_dictionary"};
+	}
+	return dictionary_iterator();
+}
+
+json_view json_view::operator[](std::string_view key) const {
+	if (!is_dictionary()) {
+		throw json_exception{"Wrong json_view type for operator[]"};
+	}
+
+	for (auto it = begin_dictionary(); it; ++it) {
+		if (it->first == key) {
+			return it->second;
+		}
+	}
+	throw json_exception{"Unable to find key '" + std::string(key) + "' for json_view"};
+}
+
+json_view json_view::at(size_t index) const {
+	if (!is_list()) {
+		throw json_exception{"Wrong json_view type for at"};
+	}
+
+	auto it = begin_list();
+	for (size_t i = 0; i < index && it; i++) {
+		++it;
+	}
+	if (!it) {
+		throw json_exception{"Index " + std::to_string(index) + " out of range for json_view"};
+	}
+	return *it;
+}
+
+// Paths to keep out of a document, as JSON Pointers like "/user/id" or as dotted paths like
+// "user.id", where "*" stands for any key or element and the empty path for the whole
+// document. They are compiled into a trie whose levels are those of the document
+struct json_paths {
+	struct node {
+		std::string name;
+		bool whole = false;
+		std::vector<node> children;
+
+		// Since "*" is merged into its siblings, a key only ever follows one branch
+		const node* find(std::string_view key) const {
+			const node* any = nullptr;
+			for (const node& child : children) {
+				if (child.name == key) {
+					return &child;
+				} else if (child.name == "*") {
+					any = &child;
+				}
+			}
+			return any;
+		}
+
+		node& child(std::string_view key) {
+			for (node& existing : children) {
+				if (existing.name == key) {
+					return existing;
+				}
+			}
+			children.push_back(node{std::string(key), false, {}});
+			return children.back();
+		}
+	};
+
+	node root;
+
+	json_paths(const std::vector<std::string>& paths) {
+		for (const std::string& path : paths) {
+			node* target = &root;
+			for (const std::string& segment : split(path)) {
+				target = &target->child(segment);
+			}
+			target->whole = true;
+		}
+		expand(root);
+	}
+
+	json_paths(std::initializer_list<std::string> paths) : json_paths(std::vector<std::string>(paths)) {}
+
+	private:
+		static std::vector<std::string> split(const std::string& path) {
+			std::vector<std::string> segments;
+			if (path.empty()) {
+				return segments;
+			}
+
+			bool pointer = path[0] == '/';
+			char separator = pointer ? '/' : '.';
+			size_t start = pointer ? 1 : 0;
+			for (;;) {
+				size_t next = path.find(separator, start);
+				std::string segment = path.substr(start, next == std::string::npos ? std::string::npos : next - start);
+				if (pointer) {
+					for (size_t i = 0; (i = segment.find('~', i)) != std::string::npos; i++) {
+						if (i + 1 < segment.size() && (segment[i + 1] == '0' || segment[i + 1] == '1')) {
+							segment.replace(i, 2, segment[i + 1] == '0' ? "~" : "/");
+						}
+					}
+				}
+				segments.push_back(segment);
+				if (next == std::string::npos) {
+					return segments;
+				}
+				start = next + 1;
+			}
+		}
+
+		static void merge(node& target, const node& source) {
+			target.whole = target.whole || source.whole;
+			for (const node& child : source.children) {
+				merge(target.child(child.name), child);
+			}
+		}
+
+		// Keys matching a sibling of "*" must also follow what follows "*"
+		static void expand(node& target) {
+			const node* any = nullptr;
+			for (const node& child : target.children) {
+				if (child.name == "*") {
+					any = &child;
+				}
+			}
+			for (node& child : target.children) {
+				if (any != nullptr && &child != any) {
+					merge(child, *any);
+				}
+				expand(child);
+			}
+		}
+};
+
+// Builds the values on some paths of a document, stepping over every other one by only
+// matching its brackets. It only descends into the containers on the paths, so its
+// recursion is no deeper than they are long
+struct projector {
+	// Output value made the first time something is stored in it, along with its containers
+	struct slot {
+		slot* parent;
+		std::string_view key;
+		bool item;
+		json* value;
+	};
+
+	const char* begin;
+	const char* end;
+	size_t max_depth;
+	std::vector<json_impl*> containers;
+	std::vector<bool> open;
+
+	// Start of the token being read, which errors are reported at
+	const char* position;
+
+	json& make(slot& target) {
+		if (target.value == nullptr) {
+			json& container = make(*target.parent);
+			json_impl& node = json_node(container);
+			if (target.item) {
+				if (!container.is_list()) {
+					node.make_list();
+				}
+				target.value = &node.append_item();
+			} else {
+				if (!container.is_dictionary()) {
+					node.make_dict();
+				}
+				target.value = &node.append(node.owner()->keep(target.key), node.create())->value;
+			}
+		}
+		return *target.value;
+	}
+
+	const char* parse_whole(const char* ptr, slot& target, size_t depth) {
+		const char* last = skip_view_value(ptr, end);
+		reader input(ptr, last - ptr);
+		document_builder builder{&make(target), containers};
+		parser<document_builder> machine{builder, open, max_depth - depth};
+		containers.clear();
+		open.clear();
+		try {
+			machine.run(input, true);
+		} catch (const json_exception& e) {
+			position = ptr + input.offset();
+			throw;
+		}
+		return last;
+	}
+
+	const char* expect(const char* ptr, char expected) {
+		position = skip_view_spaces(ptr, end);
+		return expect_view(ptr, end, expected);
+	}
+
+	const char* value_at(const char* ptr) {
+		position = skip_view_spaces(ptr, end);
+		if (position == end) {
+			throw json_exception{"Expected JSON, got EOF"};
+		}
+		return position;
+	}
+
+	// Projects the value at ptr onto the paths below node, returning where it ends
+	const char* project(const char* ptr, const json_paths::node& node, slot& target, size_t depth) {
+		if (node.whole) {
+			return parse_whole(ptr, target, depth);
+		}
+
+		bool is_list = *ptr == '[';
+		if ((!is_list && *ptr != '{') || node.children.empty()) {
+			return skip_view_value(ptr, end);
+		}
+		if (depth == max_depth) {
+			position = ptr;
+			throw json_exception{"Depth " + std::to_string(depth + 1) + " out of range"};
+		}
+
+		const char* first = skip_view_spaces(ptr + 1, end);
+		if (first != end && *first == (is_list ? ']' : '}')) {
+			return first + 1;
+		}
+
+		ptr = first;
+		std::string buffer;
+		for (size_t index = 0;; index++) {
+			std::string_view key;
+			if (is_list) {
+				ptr = value_at(ptr);
+			} else {
+				expect(ptr, '"');
+				const char* key_end = view_string_end(position, end);
+				key = view_text(position, key_end, buffer);
+				ptr = value_at(expect(key_end + 1, ':'));
+			}
+
+			const json_paths::node* child = node.find(is_list ? std::string_view(std::to_string(index)) : key);
+			if (child != nullptr) {
+				slot inner{&target, key, is_list, nullptr};
+				ptr = project(ptr, *child, inner, depth + 1);
+			} else {
+				ptr = skip_view_value(ptr, end);
+			}
+
+			ptr = skip_view_spaces(ptr, end);
+			if (ptr == end || *ptr != ',') {
+				return expect(ptr, is_list ? ']' : '}');
+			}
+			ptr++;
+		}
+	}
+};
+
+// Parses only the values on the given paths, along with the containers leading to them,
+// skipping the rest of the document at scan speed without checking it
+json json_parse(const char* data, size_t size, const json_paths& paths, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	if (paths.root.whole) {
+		return json_parse(data, size, max_depth);
+	}
+
+	json result;
+	json_impl::start_document(result);
+	projector walker{data, data + size, max_depth, {}, {}, data};
+	try {
+		projector::slot root{nullptr, {}, false, &result};
+		const char* last = walker.project(walker.value_at(data), paths.root, root, 0);
+		walker.position = skip_view_spaces(last, data + size);
+		if (walker.position != data + size) {
+			throw json_exception{"Expected EOF, got byte " + std::to_string((int) *walker.position)};
+		}
+	} catch (const json_exception& e) {
+		throw json_parse_exception{{e.msg}, (size_t) (walker.position - data)};
+	}
+	return result;
+}
+
+json json_parse(std::string_view text, const json_paths& paths, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	return json_parse(text.data(), text.size(), paths, max_depth);
+}
+
+json json_load_file(const std::string& path, const json_paths& paths, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	mapped_file file(path);
+	return json_parse(file.data, file.size, paths, max_depth);
+}
+
+std::istream& operator>>(std::istream& lhs, json& rhs) {
+	std::streampos start = lhs.tellg();
+
+	// Reading the stream up to its end leaves it in the same EOF state as the old
+	// trailing `lhs >> symbol` check did
+	json_push_parser parser(rhs);
+	char chunk[1 << 16];
+	try {
+		do {
+			lhs.read(chunk, sizeof(chunk));
+			parser.feed(chunk, lhs.gcount());
+		} while (lhs);
+		parser.finish();
+	} catch (const json_parse_exception& e) {
+		// Leave the stream right after the offending bytes, as it was before
+		if (start != std::streampos(-1)) {
+			lhs.clear();
+			lhs.seekg(start + std::streamoff(e.offset));
+		}
+		throw;
+	}
+	return lhs;
+}
+
+// Output of the serializer, gathered in a buffer of its own so that it is handed on in
+// large blocks rather than token by token
+template <typename Flush>
+struct output_buffer {
+	char data[1 << 16];
+	size_t size = 0;
+	Flush flush;
+
+	output_buffer(Flush sink) : flush(sink) {}
+
+	void put(char symbol) {
+		if (size == sizeof(data)) {
+			drain();
+		}
+		data[size++] = symbol;
+	}
+
+	void append(const char* text, size_t length) {
+		if (length > sizeof(data) - size) {
+			drain();
+			if (length > sizeof(data)) {
+				flush(text, length);
+				return;
+			}
+		}
+		std::memcpy(data + size, text, length);
+		size += length;
+	}
+
+	// Room for length bytes at the end of the buffer, or null when they don't fit
+	char* claim(size_t length) {
+		if (length > sizeof(data) - size) {
+			return nullptr;
+		}
+		size += length;
+		return data + size - length;
+	}
+
+	void drain() {
+		flush(data, size);
+		size = 0;
+	}
+};
+
+// Integers are formatted as such, which is cheaper, and other numbers as the shortest
+// text that parses back to the same double
+template <typename Output>
+static void write_number(Output& out, double number) {
+	char text[32];
+	std::to_chars_result result;
+	if (std::abs(number) < 1e15 && number == (double) (int64_t) number && !(number == 0 && std::signbit(number))) {
+		result = std::to_chars(text, text + sizeof(text), (int64_t) number);
+	} else {
+		result = std::to_chars(text, text + sizeof(text), number);
+	}
+	out.append(text, result.ptr - text);
+}
+
+// Writes the text between quotes, copying the runs that need no escaping in one go
+template <typename Output>
+static void write_string(Output& out, std::string_view text) {
+	const char* ptr = text.data();
+	const char* end = ptr + text.size();
+
+	// Most strings are short, and cheaper to scan in place than to hand over
+	const char* unsafe = text.size() < 32 ? find_unsafe_scalar(ptr, end) : find_unsafe(ptr, end);
+	char* room;
+	if (unsafe == end && (room = out.claim(text.size() + 2)) != nullptr) {
+		room[0] = '"';
+		std::memcpy(room + 1, ptr, text.size());
+		room[text.size() + 1] = '"';
+		return;
+	}
+
+	out.put('"');
+	for (;;) {
+		out.append(ptr, unsafe - ptr);
+		if (unsafe == end) {
+			break;
+		}
+
+		char symbol = *unsafe;
+		if (symbol == '"') {
+			out.append("\\\"", 2);
+		} else if (symbol == '\\') {
+			out.append("\\\\", 2);
+		} else if (symbol == '\n') {
+			out.append("\\n", 2);
+		} else if (symbol == '\t') {
+			out.append("\\t", 2);
+		} else if (symbol == '\r') {
+			out.append("\\r", 2);
+		} else if (symbol == '\b') {
+			out.append("\\b", 2);
+		} else if (symbol == '\f') {
+			out.append("\\f", 2);
+		} else {
+			const char* digits = "0123456789abcdef";
+			char escape[] = {'\\', 'u', '0', '0', digits[symbol >> 4], digits[symbol & 0xf]};
+			out.append(escape, sizeof(escape));
+		}
+		ptr = unsafe + 1;
+		unsafe = end - ptr < 32 ? find_unsafe_scalar(ptr, end) : find_unsafe(ptr, end);
+	}
+	out.put('"');
+}
+
+// Writes compact JSON without recursion, keeping the containers being written on a stack
+template <typename Output>
+static void write_json(Output& out, const json& value) {
+	struct frame {
+		const json_impl* node;
+		size_t index;
+		const json_impl::list* pair;
+	};
+	std::vector<frame> open;
+
+	const json* next = &value;
+	for (;;) {
+		json_impl::json_type kind = json_impl::type_of(*next);
+		if (kind == json_impl::JSON_NULL) {
+			out.append("null", 4);
+		} else {
+			const json_impl& node = json_node(*next);
+			if (kind == json_impl::JSON_NUMBER) {
+				write_number(out, node.n);
+			} else if (kind == json_impl::JSON_BOOL) {
+				node.b ? out.append("true", 4) : out.append("false", 5);
+			} else if (kind == json_impl::JSON_STR) {
+				write_string(out, node.s->value);
+			} else if (kind == json_impl::JSON_LIST) {
+				out.put('[');
+				open.push_back(frame{&node, 0, nullptr});
+			} else {
+				out.put('{');
+				open.push_back(frame{&node, 0, node.d->head});
+			}
+		}
+
+		// Moves on to the next value, closing the containers that are done
+		next = nullptr;
+		while (next == nullptr && !open.empty()) {
+			frame& top = open.back();
+			if (top.node->type() == json_impl::JSON_LIST) {
+				if (top.index < top.node->l->size) {
+					if (top.index > 0) {
+						out.put(',');
+					}
+					next = &top.node->l->items[top.index++];
+				} else {
+					out.put(']');
+					open.pop_back();
+				}
+			} else if (top.pair != nullptr) {
+				if (top.pair != top.node->d->head) {
+					out.put(',');
+				}
+				write_string(out, *top.pair->key);
+				out.put(':');
+				next = &top.pair->value;
+				top.pair = top.pair->next;
+			} else {
+				out.put('}');
+				open.pop_back();
+			}
+		}
+		if (next == nullptr) {
+			return;
+		}
+	}
+}
+
+void json_dump_to(const json& value, std::string& text) {
+	auto flush = [&](const char* data, size_t size) {
+		text.append(data, size);
+	};
+	output_buffer<decltype(flush)> out(flush);
+	write_json(out, value);
+	out.drain();
+}
+
+std::string json_dump(const json& value) {
+	std::string text;
+	json_dump_to(value, text);
+	return text;
+}
+
+static void write_all(int fd, const char* data, size_t size) {
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		} else if (written < 0) {
+			throw json_exception{"Unable to write to file descriptor " + std::to_string(fd)};
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+void json_dump_to(const json& value, int fd) {
+	auto flush = [fd](const char* data, size_t size) {
+		write_all(fd, data, size);
+	};
+	output_buffer<decltype(flush)> out(flush);
+	write_json(out, value);
+	out.drain();
+}
+
+std::ostream& operator<<(std::ostream& lhs, const json& rhs) {
+	auto flush = [&](const char* data, size_t size) {
+		lhs.write(data, size);
+	};
+	output_buffer<decltype(flush)> out(flush);
+	write_json(out, rhs);
+	out.drain();
+	return lhs;
+}
+
+// Writes a document call by call, formatted like operator<<, so that it never has to
+// exist as a json. Output is buffered until flush() or the end of the writer
+struct json_writer {
+	using sink = std::function<void(const char* data, size_t size)>;
+
+	json_writer(std::string& text)
+		: out(new output_buffer<sink>([&text](const char* data, size_t size) {
+			text.append(data, size);
+		})) {}
+
+	json_writer(int fd)
+		: out(new output_buffer<sink>([fd](const char* data, size_t size) {
+			write_all(fd, data, size);
+		})) {}
+
+	json_writer(std::ostream& stream)
+		: out(new output_buffer<sink>([&stream](const char* data, size_t size) {
+			stream.write(data, size);
+		})) {}
+
+	~json_writer() {
+		try {
+			flush();
+		} catch (const json_exception&) {
+			// Destructors can't throw, call flush() to see the error
+		}
+	}
+
+	void begin_object() {
+		start_value("begin_object");
+		out->put('{');
+		open.push_back(false);
+		first = true;
+		after_key = false;
+	}
+
+	void end_object() {
+		if (open.empty() || open.back() || after_key) {
+			throw json_exception{"Wrong json_writer state for end_object"};
+		}
+		out->put('}');
+		close_value();
+	}
+
+	void begin_array() {
+		start_value("begin_array");
+		out->put('[');
+		open.push_back(true);
+		first = true;
+		after_key = false;
+	}
+
+	void end_array() {
+		if (open.empty() || !open.back()) {
+			throw json_exception{"Wrong json_writer state for end_array"};
+		}
+		out->put(']');
+		close_value();
+	}
+
+	void key(std::string_view name) {
+		if (open.empty() || open.back() || after_key) {
+			throw json_exception{"Wrong json_writer state for key"};
+		}
+		if (!first) {
+			out->put(',');
+		}
+		write_string(*out, name);
+		out->put(':');
+		after_key = true;
+	}
+
+	void value(std::nullptr_t) {
+		start_value("value");
+		out->append("null", 4);
+		end_value();
+	}
+
+	void value(bool flag) {
+		start_value("value");
+		flag ? out->append("true", 4) : out->append("false", 5);
+		end_value();
+	}
+
+	void value(double number) {
+		start_value("value");
+		write_number(*out, number);
+		end_value();
+	}
+
+	// Any other arithmetic type would be ambiguous between bool and double
+	template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	void value(T number) {
+		value(static_cast<double>(number));
+	}
+
+	void value(std::string_view text) {
+		start_value("value");
+		write_string(*out, text);
+		end_value();
+	}
+
+	void value(const char* text) {
+		value(std::string_view(text));
+	}
+
+	void value(const std::string& text) {
+		value(std::string_view(text));
+	}
+
+	void value(const json& subtree) {
+		start_value("value");
+		write_json(*out, subtree);
+		end_value();
+	}
+
+	// Whether a whole document was written
+	bool complete() const {
+		return done;
+	}
+
+	void flush() {
+		out->drain();
+	}
+
+	private:
+		std::unique_ptr<output_buffer<sink>> out;
+		std::vector<bool> open;	// Whether each open container is an array
+		bool first = true;	// Nothing written yet in the innermost container
+		bool after_key = false;
+		bool done = false;
+
+		void start_value(const char* call) {
+			if (done || (!open.empty() && open.back() != !after_key)) {
+				throw json_exception{std::string("Wrong json_writer state for ") + call};
+			}
+			if (!open.empty() && open.back() && !first) {
+				out->put(',');
+			}
+		}
+
+		void end_value() {
+			first = false;
+			after_key = false;
+			done = open.empty();
+		}
+
+		void close_value() {
+			open.pop_back();
+			end_value();
 		}
-		parse_expect(stream, '}');
+};
+
+// Writes the head of a CBOR item: its major type, and the count, length or value after it
+// in as few bytes as it fits in
+template <typename Output>
+static void write_head(Output& out, uint8_t major, uint64_t value) {
+	char head[9];
+	size_t bytes;
+	uint8_t info;
+	if (value < 24) {
+		bytes = 0;
+		info = (uint8_t) value;
+	} else if (value < (1 << 8)) {
+		bytes = 1;
+		info = 24;
+	} else if (value < (1 << 16)) {
+		bytes = 2;
+		info = 25;
+	} else if (value < (1ull << 32)) {
+		bytes = 4;
+		info = 26;
 	} else {
-		stream.putback(symbol);
-		parse_primitive(stream, container);
+		bytes = 8;
+		info = 27;
 	}
+	head[0] = (char) (major << 5 | info);
+	for (size_t i = bytes; i > 0; i--) {
+		head[i] = (char) value;
+		value >>= 8;
+	}
+	out.append(head, bytes + 1);
 }
 
-std::istream& operator>>(std::istream& lhs, json& rhs) {
-	parse_json(lhs, rhs);
+// Integers are written as such, and other numbers as single floats when that loses nothing
+template <typename Output>
+static void write_binary_number(Output& out, double number) {
+	if (number >= 0 && number < 18446744073709551616.0 && number == std::floor(number) && !std::signbit(number)) {
+		write_head(out, 0, (uint64_t) number);
+	} else if (number < 0 && number >= -9223372036854775808.0 && number == std::floor(number)) {
+		write_head(out, 1, ~(uint64_t) (int64_t) number);
+	} else if (std::abs(number) <= std::numeric_limits<float>::max() && (double) (float) number == number) {
+		float single = (float) number;
+		uint32_t bits;
+		std::memcpy(&bits, &single, sizeof(bits));
+		out.put((char) 0xfa);
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			out.put((char) (bits >> shift));
+		}
+	} else {
+		uint64_t bits;
+		std::memcpy(&bits, &number, sizeof(bits));
+		out.put((char) 0xfb);
+		for (int shift = 56; shift >= 0; shift -= 8) {
+			out.put((char) (bits >> shift));
+		}
+	}
+}
+
+// Writes CBOR without recursion, in the same order as write_json
+template <typename Output>
+static void write_binary(Output& out, const json& value) {
+	struct frame {
+		const json_impl* node;
+		size_t index;
+		const json_impl::list* pair;
+	};
+	std::vector<frame> open;
+
+	const json* next = &value;
+	for (;;) {
+		json_impl::json_type kind = json_impl::type_of(*next);
+		if (kind == json_impl::JSON_NULL) {
+			out.put((char) 0xf6);
+		} else {
+			const json_impl& node = json_node(*next);
+			if (kind == json_impl::JSON_NUMBER) {
+				write_binary_number(out, node.n);
+			} else if (kind == json_impl::JSON_BOOL) {
+				out.put((char) (node.b ? 0xf5 : 0xf4));
+			} else if (kind == json_impl::JSON_STR) {
+				write_head(out, 3, node.s->value.size());
+				out.append(node.s->value.data(), node.s->value.size());
+			} else if (kind == json_impl::JSON_LIST) {
+				write_head(out, 4, node.l->size);
+				open.push_back(frame{&node, 0, nullptr});
+			} else {
+				write_head(out, 5, node.d->size);
+				open.push_back(frame{&node, 0, node.d->head});
+			}
+		}
 
-	char symbol = 0;
-	lhs >> symbol;
-	if (lhs) {
-		throw json_exception{"Expected EOF, got byte " + std::to_string((int) symbol)};
+		next = nullptr;
+		while (next == nullptr && !open.empty()) {
+			frame& top = open.back();
+			if (top.node->type() == json_impl::JSON_LIST) {
+				if (top.index < top.node->l->size) {
+					next = &top.node->l->items[top.index++];
+				} else {
+					open.pop_back();
+				}
+			} else if (top.pair != nullptr) {
+				write_head(out, 3, top.pair->key->size());
+				out.append(top.pair->key->data(), top.pair->key->size());
+				next = &top.pair->value;
+				top.pair = top.pair->next;
+			} else {
+				open.pop_back();
+			}
+		}
+		if (next == nullptr) {
+			return;
+		}
 	}
-	return lhs;
 }
 
-std::ostream& operator<<(std::ostream& lhs, const json& rhs) {
-	if (rhs.is_list()) {
-		lhs << "[";
-		auto it = rhs.begin_list();
-		while (it != rhs.end_list()) {
-			lhs << *it;
-			if (++it != rhs.end_list()) {
-				lhs << ",";
-			}
-		}
-		lhs << "]";
-	} else if (rhs.is_dictionary()) {
-		lhs << "{";
-		auto it = rhs.begin_dictionary();
-		while (it != rhs.end_dictionary()) {
-			lhs << "\"" << it->first << "\":" << it->second;
-			if (++it != rhs.end_dictionary()) {
-				lhs << ",";
-			}
-		}
-		lhs << "}";
-	} else if (rhs.is_string()) {
-		lhs << "\"" << rhs.get_string() << "\"";
-	} else if (rhs.is_number()) {
-		lhs << rhs.get_number();
-	} else if (rhs.is_bool()) {
-		lhs << (rhs.get_bool() ? "true" : "false");
-	} else if (rhs.is_null()) {
-		lhs << "null";
+// Appends value to data as CBOR (RFC 8949), which json_from_binary reads back exactly
+void json_to_binary(const json& value, std::string& data) {
+	auto flush = [&](const char* bytes, size_t size) {
+		data.append(bytes, size);
+	};
+	output_buffer<decltype(flush)> out(flush);
+	write_binary(out, value);
+	out.drain();
+}
+
+std::string json_to_binary(const json& value) {
+	std::string data;
+	json_to_binary(value, data);
+	return data;
+}
+
+void json_to_binary(const json& value, int fd) {
+	auto flush = [fd](const char* bytes, size_t size) {
+		write_all(fd, bytes, size);
+	};
+	output_buffer<decltype(flush)> out(flush);
+	write_binary(out, value);
+	out.drain();
+}
+
+// Reads the head of a CBOR item, leaving its first byte in initial, and returns the count,
+// length or bits of the value that follow it
+static uint64_t read_head(const char*& ptr, const char* end, uint8_t& initial) {
+	if (ptr == end) {
+		throw json_exception{"Expected CBOR item, got EOF"};
+	}
+	initial = (uint8_t) *ptr++;
+	uint8_t info = initial & 0x1f;
+	if (info < 24) {
+		return info;
+	} else if (info > 27) {
+		throw json_exception{"Unsupported CBOR item, got byte " + std::to_string(initial)};
+	}
+
+	size_t bytes = (size_t) 1 << (info - 24);
+	if ((size_t) (end - ptr) < bytes) {
+		throw json_exception{"Expected CBOR item, got EOF"};
+	}
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; i++) {
+		value = value << 8 | (uint8_t) ptr[i];
+	}
+	ptr += bytes;
+	return value;
+}
+
+static std::string_view read_text(const char*& ptr, const char* end, uint64_t length) {
+	if ((uint64_t) (end - ptr) < length) {
+		throw json_exception{"Expected " + std::to_string(length) + " bytes of text, got EOF"};
+	}
+	std::string_view text(ptr, length);
+	ptr += length;
+	return text;
+}
+
+static double half_to_double(uint16_t half) {
+	int exponent = (half >> 10) & 0x1f;
+	int mantissa = half & 0x3ff;
+	double number;
+	if (exponent == 0) {
+		number = std::ldexp(mantissa, -24);
+	} else if (exponent != 31) {
+		number = std::ldexp(mantissa + 1024, exponent - 25);
+	} else {
+		number = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+	}
+	return half & 0x8000 ? -number : number;
+}
+
+// Builds a document from CBOR without recursion. Every count and length is known upfront,
+// so lists are allocated once and nothing needs to be scanned or unescaped
+static void read_binary(const char* data, size_t size, json& container, size_t max_depth) {
+	static thread_local std::vector<json_impl*> open;
+	// Items left in each open container, and whether it is a dictionary
+	static thread_local std::vector<std::pair<uint64_t, bool>> left;
+	open.clear();
+	left.clear();
+
+	json_impl::start_document(container);
+	document_builder builder{&container, open};
+	const char* ptr = data;
+	const char* end = data + size;
+	const char* item = ptr;
+	try {
+		for (;;) {
+			item = ptr;
+			uint8_t initial;
+			uint64_t value = read_head(ptr, end, initial);
+			uint8_t major = initial >> 5;
+			if (major == 0) {
+				builder.number((double) value);
+			} else if (major == 1) {
+				// The number is -1 - value, which is computed with a single rounding
+				builder.number(value == UINT64_MAX ? -18446744073709551616.0 : -(double) (value + 1));
+			} else if (major == 3) {
+				builder.string(read_text(ptr, end, value));
+			} else if (major == 4 || major == 5) {
+				if (left.size() == max_depth) {
+					throw json_exception{"Depth " + std::to_string(left.size() + 1) + " out of range"};
+				}
+				// Each item takes a byte at least, which bounds what a corrupt count can reserve
+				if (value > (uint64_t) (end - ptr)) {
+					throw json_exception{"Expected " + std::to_string(value) + " items, got EOF"};
+				}
+				if (major == 4) {
+					builder.start_list();
+					open.back()->reserve(value);
+				} else {
+					builder.start_dict();
+				}
+				left.emplace_back(value, major == 5);
+			} else if (initial == 0xf4 || initial == 0xf5) {
+				builder.boolean(initial == 0xf5);
+			} else if (initial == 0xf6) {
+				builder.null();
+			} else if (initial == 0xf9) {
+				builder.number(half_to_double((uint16_t) value));
+			} else if (initial == 0xfa) {
+				uint32_t bits = (uint32_t) value;
+				float single;
+				std::memcpy(&single, &bits, sizeof(single));
+				builder.number(single);
+			} else if (initial == 0xfb) {
+				double number;
+				std::memcpy(&number, &value, sizeof(number));
+				builder.number(number);
+			} else {
+				throw json_exception{"Unsupported CBOR item, got byte " + std::to_string(initial)};
+			}
+
+			// Moves on to the next value, closing the containers that are done
+			while (!left.empty() && left.back().first == 0) {
+				left.back().second ? builder.end_dict() : builder.end_list();
+				left.pop_back();
+			}
+			if (left.empty()) {
+				break;
+			}
+			left.back().first--;
+			if (left.back().second) {
+				item = ptr;
+				uint64_t length = read_head(ptr, end, initial);
+				if (initial >> 5 != 3) {
+					throw json_exception{"Expected CBOR text key, got byte " + std::to_string(initial)};
+				}
+				builder.key(read_text(ptr, end, length));
+			} else {
+				builder.item();
+			}
+		}
+
+		if (ptr != end) {
+			item = ptr;
+			throw json_exception{"Expected EOF, got byte " + std::to_string((uint8_t) *ptr)};
+		}
+	} catch (const json_exception& e) {
+		throw json_parse_exception{{e.msg}, (size_t) (item - data)};
+	}
+}
+
+json json_from_binary(const char* data, size_t size, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	json container;
+	read_binary(data, size, container, max_depth);
+	return container;
+}
+
+json json_from_binary(std::string_view data, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	return json_from_binary(data.data(), data.size(), max_depth);
+}
+
+json json_load_binary(const std::string& path, size_t max_depth = DEFAULT_MAX_DEPTH) {
+	mapped_file file(path);
+	return json_from_binary(file.data, file.size, max_depth);
+}
+
+// A tape lays a document out flat: a header, a record for each value in document order,
+// with each key as a string record right before its value, and the text of the strings.
+// Records hold sizes and offsets instead of pointers, so a tape is read where it is mapped
+static constexpr char TAPE_MAGIC[] = "JSONTAP1";
+
+struct tape_header {
+	char magic[8];
+	uint32_t nodes;
+	uint32_t bytes;
+};
+
+enum tape_type : uint32_t {
+	TAPE_NULL,
+	TAPE_FALSE,
+	TAPE_TRUE,
+	TAPE_NUMBER,
+	TAPE_STRING,
+	TAPE_LIST,
+	TAPE_DICT
+};
+
+struct tape_node {
+	uint32_t type;
+	uint32_t size;	// Length of a string, or count of a container
+	uint64_t payload;	// Bits of a number, offset of a string, or records of a container and under it
+};
+
+static const tape_node* skip_tape_value(const tape_node* node) {
+	return node->type == TAPE_LIST || node->type == TAPE_DICT ? node + node->payload : node + 1;
+}
+
+static std::string_view tape_text(const tape_node* node, const char* blob) {
+	return std::string_view(blob + node->payload, node->size);
+}
+
+// Lays value out without recursion, storing the text of each distinct key once
+static void build_tape(const json& value, std::vector<tape_node>& nodes, std::string& blob) {
+	struct frame {
+		const json_impl* node;
+		size_t index;
+		const json_impl::list* pair;
+		size_t start;
+	};
+	std::vector<frame> open;
+	std::unordered_map<std::string_view, uint64_t> keys;
+
+	auto add_text = [&](std::string_view text, bool shared) {
+		uint64_t offset = blob.size();
+		if (shared) {
+			auto found = keys.emplace(text, offset);
+			offset = found.first->second;
+			if (!found.second) {
+				nodes.push_back(tape_node{TAPE_STRING, (uint32_t) text.size(), offset});
+				return;
+			}
+		}
+		if (text.size() > UINT32_MAX) {
+			throw json_exception{"Document too large for a tape"};
+		}
+		blob.append(text);
+		nodes.push_back(tape_node{TAPE_STRING, (uint32_t) text.size(), offset});
+	};
+
+	const json* next = &value;
+	for (;;) {
+		json_impl::json_type kind = json_impl::type_of(*next);
+		if (kind == json_impl::JSON_NULL) {
+			nodes.push_back(tape_node{TAPE_NULL, 0, 0});
+		} else {
+			const json_impl& node = json_node(*next);
+			if (kind == json_impl::JSON_NUMBER) {
+				uint64_t bits;
+				std::memcpy(&bits, &node.n, sizeof(bits));
+				nodes.push_back(tape_node{TAPE_NUMBER, 0, bits});
+			} else if (kind == json_impl::JSON_BOOL) {
+				nodes.push_back(tape_node{node.b ? TAPE_TRUE : TAPE_FALSE, 0, 0});
+			} else if (kind == json_impl::JSON_STR) {
+				add_text(node.s->value, false);
+			} else if (kind == json_impl::JSON_LIST) {
+				open.push_back(frame{&node, 0, nullptr, nodes.size()});
+				nodes.push_back(tape_node{TAPE_LIST, (uint32_t) node.l->size, 0});
+			} else {
+				open.push_back(frame{&node, 0, node.d->head, nodes.size()});
+				nodes.push_back(tape_node{TAPE_DICT, (uint32_t) node.d->size, 0});
+			}
+		}
+
+		// Moves on to the next value, recording how far each finished container reaches
+		next = nullptr;
+		while (next == nullptr && !open.empty()) {
+			frame& top = open.back();
+			if (top.node->type() == json_impl::JSON_LIST && top.index < top.node->l->size) {
+				next = &top.node->l->items[top.index++];
+			} else if (top.node->type() == json_impl::JSON_DICT && top.pair != nullptr) {
+				add_text(*top.pair->key, true);
+				next = &top.pair->value;
+				top.pair = top.pair->next;
+			} else {
+				nodes[top.start].payload = nodes.size() - top.start;
+				open.pop_back();
+			}
+		}
+		if (next == nullptr) {
+			break;
+		}
+	}
+
+	// Counts can't be larger than the number of records, so this covers them too
+	if (nodes.size() > UINT32_MAX || blob.size() > UINT32_MAX) {
+		throw json_exception{"Document too large for a tape"};
+	}
+}
+
+template <typename Flush>
+static void write_tape(Flush& flush, const json& value) {
+	std::vector<tape_node> nodes;
+	std::string blob;
+	build_tape(value, nodes, blob);
+
+	tape_header header;
+	std::memcpy(header.magic, TAPE_MAGIC, sizeof(header.magic));
+	header.nodes = (uint32_t) nodes.size();
+	header.bytes = (uint32_t) blob.size();
+	flush((const char*) &header, sizeof(header));
+	flush((const char*) nodes.data(), nodes.size() * sizeof(tape_node));
+	flush(blob.data(), blob.size());
+}
+
+// Appends value to data as a tape, to be opened with json_tape
+void json_to_tape(const json& value, std::string& data) {
+	auto flush = [&](const char* bytes, size_t size) {
+		data.append(bytes, size);
+	};
+	write_tape(flush, value);
+}
+
+std::string json_to_tape(const json& value) {
+	std::string data;
+	json_to_tape(value, data);
+	return data;
+}
+
+void json_to_tape(const json& value, int fd) {
+	auto flush = [fd](const char* bytes, size_t size) {
+		write_all(fd, bytes, size);
+	};
+	write_tape(flush, value);
+}
+
+// Read-only view of a value in a tape. Everything it returns points into the tape, which
+// must outlive it, and sizes are stored, so nothing is allocated or parsed. Finding a key
+// or an element steps over the values before it in one hop each
+struct json_tape_view {
+	struct list_iterator;
+	struct dictionary_iterator;
+
+	bool is_list() const {
+		return node->type == TAPE_LIST;
+	}
+
+	bool is_dictionary() const {
+		return node->type == TAPE_DICT;
+	}
+
+	bool is_string() const {
+		return node->type == TAPE_STRING;
+	}
+
+	bool is_number() const {
+		return node->type == TAPE_NUMBER;
+	}
+
+	bool is_bool() const {
+		return node->type == TAPE_FALSE || node->type == TAPE_TRUE;
+	}
+
+	bool is_null() const {
+		return node->type == TAPE_NULL;
+	}
+
+	json_tape_view operator[](std::string_view key) const;
+	json_tape_view at(size_t index) const;
+
+	list_iterator begin_list() const;
+	list_iterator end_list() const;
+
+	dictionary_iterator begin_dictionary() const;
+	dictionary_iterator end_dictionary() const;
+
+	// Number of elements of a list or pairs of a dictionary
+	size_t size() const {
+		if (!is_list() && !is_dictionary()) {
+			throw json_exception{"Wrong json_tape_view type for size"};
+		}
+		return node->size;
+	}
+
+	double get_number() const {
+		if (!is_number()) {
+			throw json_exception{"Wrong json_tape_view type for get_number"};
+		}
+		double number;
+		std::memcpy(&number, &node->payload, sizeof(number));
+		return number;
+	}
+
+	bool get_bool() const {
+		if (!is_bool()) {
+			throw json_exception{"Wrong json_tape_view type for get_bool"};
+		}
+		return node->type == TAPE_TRUE;
+	}
+
+	std::string_view get_string() const {
+		if (!is_string()) {
+			throw json_exception{"Wrong json_tape_view type for get_string"};
+		}
+		return tape_text(node, blob);
+	}
+
+	// Copies the whole value
+	json to_json() const;
+
+	private:
+		const tape_node* node;
+		const char* blob;
+
+		json_tape_view(const tape_node* record, const char* text) : node(record), blob(text) {}
+
+		friend struct json_tape;
+};
+
+struct json_tape_view::list_iterator {
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = json_tape_view;
+	using difference_type = std::ptrdiff_t;
+	using reference = json_tape_view;
+
+	struct pointer {
+		reference element;
+
+		const reference* operator->() const {
+			return &element;
+		}
+	};
+
+	// The cursor is null past the last element
+	list_iterator(const tape_node* element = nullptr, size_t count = 0, const char* text = nullptr)
+		: ptr(element), left(count), blob(text) {}
+
+	reference operator*() const {
+		return json_tape_view(ptr, blob);
+	}
+
+	pointer operator->() const {
+		return pointer{**this};
+	}
+
+	list_iterator& operator++() {
+		ptr = --left > 0 ? skip_tape_value(ptr) : nullptr;
+		return *this;
+	}
+
+	list_iterator operator++(int) {
+		list_iterator it(ptr, left, blob);
+		++(*this);
+		return it;
+	}
+
+	bool operator==(const list_iterator& rhs) const {
+		return ptr == rhs.ptr;
+	}
+
+	bool operator!=(const list_iterator& rhs) const {
+		return ptr != rhs.ptr;
+	}
+
+	explicit operator bool() const {
+		return ptr != nullptr;
+	}
+
+	private:
+		const tape_node* ptr;
+		size_t left;
+		const char* blob;
+};
+
+struct json_tape_view::dictionary_iterator {
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = std::pair<std::string_view, json_tape_view>;
+	using difference_type = std::ptrdiff_t;
+	using reference = value_type;
+
+	struct pointer {
+		reference pair;
+
+		const reference* operator->() const {
+			return &pair;
+		}
+	};
+
+	// The cursor is at the record of the key, and null past the last one
+	dictionary_iterator(const tape_node* key = nullptr, size_t count = 0, const char* text = nullptr)
+		: ptr(key), left(count), blob(text) {}
+
+	reference operator*() const {
+		return reference(tape_text(ptr, blob), json_tape_view(ptr + 1, blob));
+	}
+
+	pointer operator->() const {
+		return pointer{**this};
+	}
+
+	dictionary_iterator& operator++() {
+		ptr = --left > 0 ? skip_tape_value(ptr + 1) : nullptr;
+		return *this;
+	}
+
+	dictionary_iterator operator++(int) {
+		dictionary_iterator it(ptr, left, blob);
+		++(*this);
+		return it;
+	}
+
+	bool operator==(const dictionary_iterator& rhs) const {
+		return ptr == rhs.ptr;
+	}
+
+	bool operator!=(const dictionary_iterator& rhs) const {
+		return ptr != rhs.ptr;
+	}
+
+	explicit operator bool() const {
+		return ptr != nullptr;
+	}
+
+	private:
+		const tape_node* ptr;
+		size_t left;
+		const char* blob;
+};
+
+json_tape_view::list_iterator json_tape_view::begin_list() const {
+	if (!is_list()) {
+		throw json_exception{"Wrong json_tape_view type for begin_list"};
+	}
+	return node->size > 0 ? list_iterator(node + 1, node->size, blob) : list_iterator();
+}
+
+json_tape_view::list_iterator json_tape_view::end_list() const {
+	if (!is_list()) {
+		throw json_exception{"Wrong json_tape_view type for end_list"};
+	}
+	return list_iterator();
+}
+
+json_tape_view::dictionary_iterator json_tape_view::begin_dictionary() const {
+	if (!is_dictionary()) {
+		throw json_exception{"Wrong json_tape_view type for begin_dictionary"};
+	}
+	return node->size > 0 ? dictionary_iterator(node + 1, node->size, blob) : dictionary_iterator();
+}
+
+json_tape_view::dictionary_iterator json_tape_view::end_dictionary() const {
+	if (!is_dictionary()) {
+		throw json_exception{"Wrong json_tape_view type for end_dictionary"};
+	}
+	return dictionary_iterator();
+}
+
+json_tape_view json_tape_view::operator[](std::string_view key) const {
+	if (!is_dictionary()) {
+		throw json_exception{"Wrong json_tape_view type for operator[]"};
+	}
+
+	for (auto it = begin_dictionary(); it; ++it) {
+		if (it->first == key) {
+			return it->second;
+		}
+	}
+	throw json_exception{"Unable to find key '" + std::string(key) + "' for json_tape_view"};
+}
+
+json_tape_view json_tape_view::at(size_t index) const {
+	if (!is_list()) {
+		throw json_exception{"Wrong json_tape_view type for at"};
+	}
+	if (index >= node->size) {
+		throw json_exception{"Index " + std::to_string(index) + " out of range for json_tape_view"};
+	}
+
+	const tape_node* element = node + 1;
+	for (size_t i = 0; i < index; i++) {
+		element = skip_tape_value(element);
+	}
+	return json_tape_view(element, blob);
+}
+
+json json_tape_view::to_json() const {
+	std::vector<json_impl*> open;
+	// Items left in each open container, and whether it is a dictionary
+	std::vector<std::pair<size_t, bool>> left;
+
+	json container;
+	json_impl::start_document(container);
+	document_builder builder{&container, open};
+	const tape_node* ptr = node;
+	for (;;) {
+		if (ptr->type == TAPE_NULL) {
+			builder.null();
+		} else if (ptr->type == TAPE_FALSE || ptr->type == TAPE_TRUE) {
+			builder.boolean(ptr->type == TAPE_TRUE);
+		} else if (ptr->type == TAPE_NUMBER) {
+			builder.number(json_tape_view(ptr, blob).get_number());
+		} else if (ptr->type == TAPE_STRING) {
+			builder.string(tape_text(ptr, blob));
+		} else if (ptr->type == TAPE_LIST) {
+			builder.start_list();
+			open.back()->reserve(ptr->size);
+			left.emplace_back(ptr->size, false);
+		} else {
+			builder.start_dict();
+			left.emplace_back(ptr->size, true);
+		}
+		ptr++;
+
+		while (!left.empty() && left.back().first == 0) {
+			left.back().second ? builder.end_dict() : builder.end_list();
+			left.pop_back();
+		}
+		if (left.empty()) {
+			return container;
+		}
+		left.back().first--;
+		if (left.back().second) {
+			builder.key(tape_text(ptr++, blob));
+		} else {
+			builder.item();
+		}
 	}
-	return lhs;
 }
+
+// Tape written by json_to_tape, in memory or mapped from a file, which processes mapping
+// the same file share. Opening only checks the header, the records are read as written
+struct json_tape {
+	// The data must outlive the tape
+	json_tape(const char* data, size_t size) {
+		attach(data, size);
+	}
+
+	json_tape(const std::string& path) : file(std::in_place, path, MADV_RANDOM) {
+		attach(file->data, file->size);
+	}
+
+	json_tape_view root() const {
+		return json_tape_view(nodes, blob);
+	}
+
+	private:
+		std::optional<mapped_file> file;
+		const tape_node* nodes;
+		const char* blob;
+
+		void attach(const char* data, size_t size) {
+			if (size < sizeof(tape_header) || std::memcmp(data, TAPE_MAGIC, sizeof(tape_header::magic)) != 0) {
+				throw json_exception{"Expected json tape header"};
+			} else if ((uintptr_t) data % alignof(tape_node) != 0) {
+				throw json_exception{"Expected json tape aligned to " + std::to_string(alignof(tape_node)) + " bytes"};
+			}
+
+			tape_header header;
+			std::memcpy(&header, data, sizeof(header));
+			size_t expected = sizeof(header) + (size_t) header.nodes * sizeof(tape_node) + header.bytes;
+			if (header.nodes == 0 || size != expected) {
+				throw json_exception{"Expected json tape of " + std::to_string(expected) + " bytes, got " + std::to_string(size)};
+			}
+			nodes = (const tape_node*) (data + sizeof(header));
+			blob = (const char*) (nodes + header.nodes);
+		}
+};
@@ -5,6 +5,7 @@
 #include <cassert>
 #include <fstream>
 #include <algorithm>
+#include <cmath>
 using namespace std;
 
 #define ERASE_SPACES(str) \
@@ -70,6 +71,12 @@ void tests(void) {
 	TEST_PARSER("16.1e-1");
 	TEST_PARSER("-1.61");
 	TEST_PARSER("0.0");
+	TEST_PARSER_THROW("-", "Expected digit, got EOF");
+	TEST_PARSER_THROW("--1", "Expected digit, got byte 45");
+	TEST_PARSER_THROW("1.", "Expected digit, got EOF");
+	TEST_PARSER_THROW("[1.e5]", "Expected digit, got byte 101");
+	TEST_PARSER_THROW("2e+", "Expected digit, got EOF");
+	TEST_PARSER_THROW("1e400", "Number out of range");
 
 	TEST_PARSER_THROW("f", "Expected 'false', got 'f'");
 	TEST_PARSER_THROW("fals", "Expected 'false', got 'fals'");
@@ -86,11 +93,11 @@ void tests(void) {
 	TEST_PARSER_THROW("\"something", "Expected '\"', got EOF");
 	TEST_PARSER_THROW("\"\\\"", "Expected '\"', got EOF");
 	TEST_PARSER_THROW("\"something\\\"", "Expected '\"', got EOF");
-	TEST_PARSER_THROW("\"something\\\\\"", "Expected '\"', got EOF");	// NOTE: Standard wouldn't crash
 	TEST_PARSER("\"\"");
 	TEST_PARSER(" \"hi\"");
 	TEST_PARSER("\"\\\"\"");
-	TEST_PARSER("\"some \\\\\" thing\"");	// NOTE: Standard would crash
+	TEST_PARSER("\"something\\\\\"");
+	TEST_PARSER_THROW("\"some \\\\\" thing\"", "Expected EOF, got byte 116");
 	TEST_PARSER("\"hello\nworld\"");
 	TEST_PARSER("\"some \\\"other\\\" string\"");
 
@@ -192,6 +199,22 @@ void tests(void) {
 		assert(msg == "Wrong json& type for operator[]");
 	});
 
+	TEST("[0.1, -0, 9007199254740993, 123456789012345678901234567890, 1.7976931348623157e308, 4.9e-324, 2.2250738585072011e-308, 1e-400, 0.30000000000000004]", [](auto s) {
+		json j;
+		s >> j;
+
+		double expected[] = {
+			0.1, -0.0, 9007199254740992.0, 1.2345678901234568e29, 1.7976931348623157e308,
+			4.9e-324, 2.2250738585072011e-308, 0.0, 0.30000000000000004
+		};
+		size_t i = 0;
+		for (auto it = j.begin_list(); it != j.end_list(); ++it) {
+			assert(it->is_number() && it->get_number() == expected[i++]);
+		}
+		assert(i == sizeof(expected) / sizeof(*expected));
+		assert(signbit((++j.begin_list())->get_number()));
+	});
+
 	TEST("141.4e-2", [](auto s) {
 		json j;
 		s >> j;
@@ -351,6 +374,1028 @@ void tests(void) {
 		assert(j1.is_number() && j1.get_number() == 1.0);
 	});
 
+	TEST("", [](auto s) {
+		json j = json_parse(string_view(" [1, {\"a\": true}, \"b\"] \n"));
+		assert(j.is_list());
+
+		auto it = j.begin_list();
+		assert(it->is_number() && it->get_number() == 1.0);
+		assert((++it)->is_dictionary() && (*it)["a"].get_bool() == true);
+		assert((++it)->is_string() && it->get_string() == "b");
+		assert((++it) == j.end_list());
+
+		string msg;
+		try {
+			json_parse("[1] 2", 5);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected EOF, got byte 50");
+	});
+
+	TEST("[1, nul, 3]", [](auto s) {
+		string msg;
+		try {
+			json j;
+			s >> j;
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected 'null', got 'nul,'");
+
+		string rest;
+		getline(s, rest);
+		assert(rest == " 3]");
+	});
+
+	TEST("", [](auto s) {
+		string indent(100000, ' ');
+		string text = "[" + indent + "\"a  ], \\\"  {\"" + indent + "," + indent + "{\n\t\"k\"  :  1}\n\n]  ";
+		json j = json_parse(text);
+
+		auto it = j.begin_list();
+		assert(it->is_string() && it->get_string() == "a  ], \"  {");
+		assert((++it)->is_dictionary() && (*it)["k"].get_number() == 1.0);
+		assert((++it) == j.end_list());
+	});
+
+	TEST("", [](auto s) {
+		string text = string(40, 'a') + "\\\\" + string(30, 'b') + "\\\"" + string(20, ' ') + "\\\\\\\"";
+		json j = json_parse("\"" + text + "\"");
+		assert(j.is_string() && j.get_string() == string(40, 'a') + "\\" + string(30, 'b') + "\"" + string(20, ' ') + "\\\"");
+
+		string msg;
+		try {
+			json_parse("\"" + string(50, 'c') + "\\\"");
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected '\"', got EOF");
+	});
+
+	TEST("", [](auto s) {
+		string path = "/tmp/json_load_file_test.json";
+		{
+			ofstream file(path);
+			file << "{\"a\": [1, 2], \n \"b\": nul}";
+		}
+
+		string msg;
+		size_t offset = 0;
+		try {
+			json_load_file(path);
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+			offset = e.offset;
+		}
+		assert(msg == "Expected 'null', got 'nul}'" && offset == 25);
+
+		{
+			ofstream file(path);
+			file << "{\"a\": [1, 2], \n \"b\": null}";
+		}
+		json j = json_load_file(path);
+		assert(j["b"].is_null() && j["a"].begin_list()->get_number() == 1.0);
+		remove(path.c_str());
+
+		msg.clear();
+		try {
+			json_load_file(path);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Unable to open '" + path + "'");
+	});
+
+	TEST("{\"a\": [1, {\"b\": \"a string too long to be stored inline\"}], \"c\": null}", [](auto s) {
+		json moved;
+		{
+			json doc;
+			s >> doc;
+			moved = move(doc["a"]);
+			assert(doc["a"].is_null());
+
+			json extra;
+			extra.set_list();
+			extra.push_back(moved);
+			doc["c"] = extra;
+			doc["d"].set_string("another string too long to be stored inline");
+			assert(doc["c"].begin_list()->is_list() && doc["d"].is_string());
+		}
+		assert(moved.is_list());
+
+		moved.push_back(moved);
+		auto it = moved.begin_list();
+		assert(it->get_number() == 1.0);
+		assert((*(++it))["b"].get_string() == "a string too long to be stored inline");
+		assert((++it)->is_list() && (++it) == moved.end_list());
+	});
+
+	TEST("[3, [\"x\"], 1, 2]", [](auto s) {
+		json j;
+		s >> j;
+		assert(json_size(j) == 4 && json_at(j, 1).is_list());
+		assert(j.end_list() - j.begin_list() == 4 && j.begin_list()[2].get_number() == 1.0);
+		const json& constant = j;
+		assert((2 + j.begin_list())->get_number() == 1.0 && (3 + constant.begin_list())[-2].is_list());
+
+		json_at(j, 1).set_number(0);
+		sort(j.begin_list(), j.end_list(), [](const json& a, const json& b) {
+			return a.get_number() < b.get_number();
+		});
+		for (size_t i = 0; i < json_size(j); i++) {
+			assert(json_at(j, i).get_number() == (double) i);
+		}
+
+		json l;
+		l.set_list();
+		json_reserve(l, 100);
+		for (int i = 0; i < 100; i++) {
+			l.push_back(j);
+			l.push_front(json());
+		}
+		assert(json_size(l) == 200 && l.begin_list()->is_null() && (l.end_list() - 1)->is_list());
+
+		string msg;
+		try {
+			const json& c = j;
+			json_at(c, 4);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Index 4 out of range for const json&");
+	});
+
+	TEST("", [](auto s) {
+		json j;
+		j.set_dictionary();
+		for (int i = 0; i < 1000; i++) {
+			j["key" + to_string(i)].set_number(i);
+		}
+		j.insert(pair<string, json>("key7", json()));
+		assert(json_size(j) == 1001);
+
+		const json copy = j;
+		for (int i = 0; i < 1000; i++) {
+			assert(copy["key" + to_string(i)].get_number() == i);
+		}
+
+		s << j;
+		json parsed;
+		s >> parsed;
+		assert(parsed["key7"].get_number() == 7.0 && parsed["key999"].get_number() == 999.0);
+
+		auto it = parsed.begin_dictionary();
+		for (int i = 0; i < 1000; i++, ++it) {
+			assert(it->first == "key" + to_string(i));
+		}
+		assert(it->first == "key7" && it->second.is_null());
+	});
+
+	TEST("{\"a\": [1, \"x\"], \"b\": {\"c\": true}}", [](auto s) {
+		json j;
+		s >> j;
+
+		json l;
+		l.set_list();
+		json n;
+		n.set_number(5);
+		const double* address = &n.get_number();
+		json_push_back(l, std::move(n));
+		assert(n.is_null() && &json_at(l, 0).get_number() == address);
+
+		json_push_front(l, std::move(j["a"]));
+		assert(j["a"].is_null() && json_size(json_at(l, 0)) == 2);
+		assert(json_at(json_at(l, 0), 1).get_string() == "x");
+
+		json_insert(j, pair<string, json>("d", std::move(l)));
+		assert(l.is_null() && json_size(j["d"]) == 2 && json_at(j["d"], 1).get_number() == 5);
+
+		json_emplace_back(j["d"]).set_string("y");
+		auto [value, inserted] = json_try_emplace(j, "b");
+		assert(!inserted && value["c"].get_bool());
+		auto [other, added] = json_try_emplace(j, "e");
+		assert(added && other.is_null() && json_size(j) == 4);
+
+		j["d"].push_back(j["d"]);
+		j["b"].insert(pair<string, json>("self", j["b"]));
+		j["b"]["self"]["self"].set_number(0);
+		stringstream out;
+		out << j;
+		assert(out.str() == "{\"a\":null,\"b\":{\"c\":true,\"self\":{\"c\":true,\"self\":0}},"
+				"\"d\":[[1,\"x\"],5,\"y\",[[1,\"x\"],5,\"y\"]],\"e\":null}");
+	});
+
+	TEST("[\"abc\", 1, true, null, [2], {\"k\": \"v\"}]", [](auto s) {
+		json j;
+		s >> j;
+		json_at(j, 0).set_string("longer than any small string buffer");
+		json_at(j, 1).set_list();
+		json_at(j, 1).push_back(json_at(j, 0));
+		json_at(j, 2).set_dictionary();
+		json_at(j, 2)["x"] = json_at(j, 5);
+		json_at(j, 4).set_bool(false);
+		json_at(j, 5).set_number(-1);
+
+		json moved = std::move(json_at(j, 2));
+		j.push_back(moved);
+		json_at(j, 0) = std::move(json_at(j, 1));
+		assert(json_at(j, 1).is_null() && moved["x"]["k"].get_string() == "v");
+
+		stringstream out;
+		out << j;
+		assert(out.str() == "[[\"longer than any small string buffer\"],null,null,null,false,-1,"
+				"{\"x\":{\"k\":\"v\"}}]");
+	});
+
+	TEST("[{\"id\": 1, \"user\": \"a\"}, {\"id\": 2, \"user\": \"b\"}]", [](auto s) {
+		json separate;
+		s >> separate;
+		assert(&json_at(separate, 0).begin_dictionary()->first != &json_at(separate, 1).begin_dictionary()->first);
+		assert(json_at(separate, 1)["user"].get_string() == "b");
+
+		json j = json_parse(s.str(), DEFAULT_MAX_DEPTH, true);
+		json& first = json_at(j, 0);
+		json& second = json_at(j, 1);
+		assert(&first.begin_dictionary()->first == &second.begin_dictionary()->first);
+		assert(second["user"].get_string() == "b");
+
+		const json& c = second;
+		string msg;
+		try {
+			c["missing"];
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Unable to create key 'missing' for const json&");
+
+		second["new"].set_bool(true);
+		json copy = first;
+		copy["id"].set_number(3);
+		first.insert(pair<string, json>("copy", copy));
+		assert(first["id"].get_number() == 1.0 && first["copy"]["id"].get_number() == 3.0);
+
+		auto it = c.begin_dictionary();
+		assert((*it).first == "id" && (++it)->second.get_string() == "b");
+		assert((++it)->first == "new" && !(++it));
+	});
+
+	TEST("{\"name\": \"config\", \"list\": [[1], \"s\"]}", [](auto s) {
+		json j;
+		s >> j;
+		const json& c = j;
+
+		// Copies share the contents until they change
+		const json copy = c;
+		assert(&copy["name"].get_string() == &c["name"].get_string());
+		json other = copy;
+		other["name"].get_string() += "!";
+		assert(c["name"].get_string() == "config" && other["name"].get_string() == "config!");
+
+		// References handed out are never shared with later copies
+		json& inner = json_at(j["list"], 0);
+		json later = j;
+		inner.push_back(inner);
+		json_at(inner, 0).set_number(2);
+		stringstream out;
+		out << later << j;
+		assert(out.str() == "{\"name\":\"config\",\"list\":[[1],\"s\"]}"
+				"{\"name\":\"config\",\"list\":[[2,[1]],\"s\"]}");
+
+		json root = later;
+		root["list"].push_back(root);
+		root["list"].push_back(later["list"]);
+		assert(json_size(root["list"]) == 4 && json_size(json_at(root["list"], 2)["list"]) == 2);
+		assert(json_size(later["list"]) == 2);
+	});
+
+	TEST("{\"a\": {\"b\": [1, {\"c\": \"x\"}], \"d\": \"y\"}}", [](auto s) {
+		json j;
+		s >> j;
+		const json& c = j;
+		size_t footprint = json_node(j).owner()->footprint();
+
+		// Copies change on the heap, never in the arena of the document they were taken from
+		auto change = [&c]() {
+			for (int i = 0; i < 20000; i++) {
+				json copy = c["a"];
+				copy["e"].set_number(i);
+				copy["b"].push_back(copy["d"]);
+				json_at(copy["b"], 1)["c"].get_string() += "z";
+				copy["d"].set_string("w");
+			}
+		};
+		thread other(change);
+		change();
+		other.join();
+		assert(json_node(j).owner()->footprint() == footprint);
+		assert(json_dump(j) == "{\"a\":{\"b\":[1,{\"c\":\"x\"}],\"d\":\"y\"}}");
+	});
+
+	TEST("", [](auto s) {
+		// A copy being changed on one thread keeps the level it copies alive, while the
+		// other copy of that level is dropped on another
+		vector<json> changed(200), dropped(200);
+		for (size_t i = 0; i < changed.size(); i++) {
+			changed[i].set_list();
+			json_reserve(changed[i], 4096);
+			for (int j = 0; j < 4096; j++) {
+				changed[i].push_back(json());
+			}
+			dropped[i] = changed[i];
+		}
+
+		atomic<size_t> current{0};
+		thread other([&]() {
+			for (size_t i = 0; i < dropped.size(); i++) {
+				while (current < i) {
+					this_thread::yield();
+				}
+				dropped[i].set_null();
+			}
+		});
+		for (size_t i = 0; i < changed.size(); i++) {
+			current = i;
+			changed[i].push_back(json());
+		}
+		other.join();
+		assert(json_size(changed.back()) == 4097);
+	});
+
+	TEST(string(1000000, '['), [](auto s) {
+		string msg;
+		try {
+			json j;
+			s >> j;
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Depth 1025 out of range");
+
+		json deep = json_parse(string(1024, '[') + string(1024, ']'));
+		assert(deep.is_list() && json_size(deep) == 1);
+
+		json j = json_parse(string_view("[{\"a\": [[]]}, {}]"), 4);
+		assert(json_size(json_at(j, 0)["a"]) == 1);
+		msg.clear();
+		try {
+			json_parse(string_view("[{\"a\": [[]]}, {}]"), 3);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Depth 4 out of range");
+	});
+
+	TEST("", [](auto s) {
+		json deep;
+		deep.set_list();
+		for (int i = 0; i < 1000000; i++) {
+			json outer;
+			outer.set_list();
+			json_push_back(outer, std::move(deep));
+			deep = std::move(outer);
+		}
+		json copy = deep;
+		deep.set_null();
+		assert(json_size(copy) == 1);
+	});
+
+	TEST("{\"k\": 1, \"l\": []}", [](auto s) {
+		// Values move into documents and between them a level at a time
+		json doc;
+		s >> doc;
+		json deep;
+		deep.set_string("bottom");
+		for (int i = 0; i < 1000000; i++) {
+			json outer;
+			outer.set_list();
+			json_push_back(outer, std::move(deep));
+			deep = std::move(outer);
+		}
+		doc["k"] = std::move(deep);
+		json_push_back(doc["l"], json_parse("[[1], {\"a\": [2]}]"));
+
+		json other = json_parse("{\"x\": null, \"y\": null}");
+		other["x"] = doc["k"];
+		other["y"] = std::move(doc["k"]);
+		doc.set_null();
+		assert(deep.is_null() && doc.is_null());
+
+		for (const char* key : {"x", "y"}) {
+			const json* level = &other[key];
+			size_t depth = 0;
+			while (level->is_list()) {
+				level = &json_at(*level, 0);
+				depth++;
+			}
+			assert(depth == 1000000 && level->get_string() == "bottom");
+		}
+	});
+
+	TEST("", [](auto s) {
+		json_background_reclaim(true);
+		{
+			json l;
+			l.set_list();
+			for (int i = 0; i < 10000; i++) {
+				l.push_back(json());
+				json_at(l, i).set_string(to_string(i));
+			}
+			string text = "[";
+			for (int i = 0; i < 100000; i++) {
+				text += "{\"key\": [" + to_string(i) + "]},";
+			}
+			json parsed = json_parse(text + "[]]");
+			assert(json_size(parsed) == 100001 && json_size(l) == 10000);
+		}
+		json_background_reclaim(false);
+
+		// Nothing dropped while it is being disabled stays queued once it is
+		atomic<bool> done{false};
+		thread dropper([&]() {
+			while (!done) {
+				json large;
+				large.set_list();
+				json_reserve(large, 5000);
+				for (int i = 0; i < 5000; i++) {
+					json_emplace_back(large);
+				}
+			}
+		});
+		auto& reclaimer = json_impl::reclaimer::instance();
+		for (int i = 0; i < 200; i++) {
+			json_background_reclaim(true);
+			json_background_reclaim(false);
+			lock_guard<mutex> lock(reclaimer.mutex);
+			assert(reclaimer.tasks.empty() && reclaimer.running == 0);
+		}
+		done = true;
+		dropper.join();
+	});
+
+	TEST("{\"a\": [1, 2.5, true, null], \"b\": {\"c\": \"d\\\"\"}, \"e\": []}", [](auto s) {
+		struct trace : json_handler {
+			string events;
+			double sum = 0;
+
+			void on_null() override { events += "n "; }
+			void on_bool(bool b) override { events += b ? "t " : "f "; }
+			void on_number(double n) override { sum += n; events += "# "; }
+			void on_string(string_view str) override { events += "'" + string(str) + "' "; }
+			void on_key(string_view key) override { events += string(key) + ": "; }
+			void on_start_object() override { events += "{ "; }
+			void on_end_object() override { events += "} "; }
+			void on_start_array() override { events += "[ "; }
+			void on_end_array() override { events += "] "; }
+		} handler;
+
+		json_parse(s.str(), handler);
+		assert(handler.events == "{ a: [ # # t n ] b: { c: 'd\"' } e: [ ] } ");
+		assert(handler.sum == 3.5);
+
+		trace partial;
+		size_t offset = 0;
+		try {
+			json_parse(string_view("[1, {\"x\": tru}]"), partial);
+		} catch (json_parse_exception e) {
+			offset = e.offset;
+		}
+		assert(partial.events == "[ # { x: " && offset == 14);
+	});
+
+	TEST("[[\"[1,2]\", 3], \"[\\\"a\\\\nb\\\"]\", 4]", [](auto s) {
+		// Handlers may parse what they are given, even strings decoded for them
+		struct nested : json_handler {
+			string events;
+
+			void on_null() override { events += "n "; }
+			void on_bool(bool b) override { events += "b "; }
+			void on_number(double n) override { events += to_string((int) n) + " "; }
+			void on_key(string_view key) override {}
+			void on_start_object() override {}
+			void on_end_object() override {}
+			void on_start_array() override { events += "[ "; }
+			void on_end_array() override { events += "] "; }
+
+			bool inner = false;
+
+			void on_string(string_view str) override {
+				if (inner) {
+					events += "'" + string(str) + "' ";
+					return;
+				}
+				nested events_of;
+				events_of.inner = true;
+				json_parse(str, events_of);
+				events += "(" + json_dump(json_parse(str)) + " " + events_of.events + ") ";
+			}
+		} handler;
+
+		json_parse(s.str(), handler);
+		assert(handler.events == "[ [ ([1,2] [ 1 2 ] ) 3 ] ([\"a\\nb\"] [ 'a\nb' ] ) 4 ] ");
+	});
+
+	TEST(" [1, -2.5e3, \"a\\\"b\", {\"key\": [true, false, null]}, {}, []] ", [](auto s) {
+		string text = s.str();
+		stringstream expected;
+		expected << json_parse(text);
+
+		for (size_t step : {1, 2, 7, 1000}) {
+			json document;
+			json_push_parser parser(document);
+			for (size_t i = 0; i < text.size(); i += step) {
+				parser.feed(text.data() + i, min(step, text.size() - i));
+			}
+			parser.finish();
+
+			stringstream output;
+			output << document;
+			assert(output.str() == expected.str());
+		}
+
+		size_t offset = 0;
+		try {
+			json document;
+			json_push_parser parser(document);
+			parser.feed("[1, 2", 5);
+			parser.feed("3 4]", 4);
+		} catch (json_parse_exception e) {
+			offset = e.offset;
+		}
+		assert(offset == 8);
+
+		try {
+			offset = 0;
+			json_handler handler;
+			json_push_parser parser(handler);
+			parser.feed("{\"a\": [1, tr", 12);
+			parser.finish();
+		} catch (json_parse_exception e) {
+			assert(e.msg == "Expected 'true', got 'tr'");
+			offset = e.offset;
+		}
+		assert(offset == 12);
+	});
+
+	TEST("", [](auto) {
+		// A token cut by many pieces in a row is only scanned once, escapes cut
+		// after their backslash included
+		string value;
+		for (int i = 0; i < 100000; i++) {
+			value += "abcdefghi\\\"";
+		}
+		string text = "[\"" + value + "\", -1234567.25e-2]";
+
+		for (size_t step : {1, 15, 16}) {
+			json document;
+			json_push_parser parser(document);
+			for (size_t i = 0; i < text.size(); i += step) {
+				parser.feed(text.data() + i, min(step, text.size() - i));
+			}
+			parser.finish();
+
+			auto it = document.begin_list();
+			assert(it->get_string().size() == 1000000);
+			assert((++it)->get_number() == -12345.6725);
+			assert(++it == document.end_list());
+		}
+	});
+
+	TEST("{\"a\": 1}\n\n  [2, 3]\r\n\"four\"", [](auto s) {
+		string input = s.str();
+		json_lines lines(input);
+		json value;
+		string output;
+		while (lines.next(value)) {
+			stringstream line;
+			line << lines.offset() << " " << value << ";";
+			output += line.str();
+		}
+		assert(output == "0 {\"a\":1};12 [2,3];20 \"four\";");
+
+		string text;
+		for (int i = 0; i < 100000; i++) {
+			text += "{\"id\": " + to_string(i) + ", \"tags\": [\"x\"]}\n";
+		}
+
+		for (bool ordered : {true, false}) {
+			mutex guard;
+			vector<double> ids;
+			json_parse_lines(text, [&](size_t, json& document) {
+				lock_guard<mutex> lock(guard);
+				ids.push_back(document["id"].get_number());
+			}, 4, ordered);
+
+			assert(ids.size() == 100000);
+			if (!ordered) {
+				sort(ids.begin(), ids.end());
+			}
+			for (size_t i = 0; i < ids.size(); i++) {
+				assert(ids[i] == i);
+			}
+		}
+
+		size_t count = 0, offset = 0;
+		try {
+			json_parse_lines(text + "[1,]\n" + text, [&](size_t, json&) { count++; }, 4);
+		} catch (json_parse_exception e) {
+			offset = e.offset;
+		}
+		assert(count == 100000 && offset == text.size() + 3);
+
+		// Input of a single chunk starts no threads at all
+		thread::id caller = this_thread::get_id();
+		bool elsewhere = false;
+		json_parse_lines("1\n2\n", [&](size_t, json&) { elsewhere |= this_thread::get_id() != caller; }, 16, false);
+		assert(!elsewhere);
+	});
+
+	TEST("[{\"a\": \"],\\\"[{\"}, [1, [2]], -3.5]", [](auto s) {
+		string text = s.str();
+		for (int i = 0; i < 50000; i++) {
+			text.pop_back();
+			text += ", {\"id\": " + to_string(i) + ", \"name\": \"x, \\\"y]\", \"tags\": [true, null]}]";
+		}
+		text += "\n";
+
+		stringstream expected, output;
+		expected << json_parse(text);
+		output << json_parse_parallel(text, 4);
+		assert(output.str() == expected.str());
+
+		string broken = text;
+		broken.replace(broken.size() / 2, 1, "}");
+		string sequential_error, parallel_error;
+		try {
+			json_parse(broken);
+		} catch (json_parse_exception e) {
+			sequential_error = e.msg + " " + to_string(e.offset);
+		}
+		try {
+			json_parse_parallel(broken, 4);
+		} catch (json_parse_exception e) {
+			parallel_error = e.msg + " " + to_string(e.offset);
+		}
+		assert(!parallel_error.empty() && parallel_error == sequential_error);
+
+		stringstream dict;
+		dict << json_parse_parallel("{\"a\": [1]}", 4);
+		assert(dict.str() == "{\"a\":[1]}");
+	});
+
+	TEST("{\"skip\": [{\"a\": \"]}\\\"\"}, [1, 2]], \"n\": -1.5, \"s\": \"x\\ny\", \"l\": [true, null, {\"k\": false}]}", [](auto s) {
+		string text = s.str();
+		json_view view(text);
+		assert(view.is_dictionary() && view["n"].get_number() == -1.5);
+		assert(view["s"].get_string() == "x\ny");
+		assert(view["l"].at(0).get_bool() && view["l"].at(1).is_null());
+		assert(view["l"].at(2)["k"].get_bool() == false);
+
+		string keys;
+		for (auto it = view.begin_dictionary(); it != view.end_dictionary(); ++it) {
+			keys += string(it->first) + " ";
+		}
+		assert(keys == "skip n s l ");
+
+		size_t count = 0;
+		for (auto it = view["skip"].begin_list(); it != view["skip"].end_list(); ++it) {
+			count += it->is_list() ? 10 : 1;
+		}
+		assert(count == 11);
+
+		stringstream output;
+		output << view["skip"].to_json();
+		assert(output.str() == "[{\"a\":\"]}\\\"\"},[1,2]]");
+
+		string error;
+		try {
+			view["missing"];
+		} catch (json_exception e) {
+			error = e.msg;
+		}
+		assert(error == "Unable to find key 'missing' for json_view");
+
+		try {
+			view["l"].at(3);
+		} catch (json_exception e) {
+			error = e.msg;
+		}
+		assert(error == "Index 3 out of range for json_view");
+
+		try {
+			json_view("{\"a\": [1, 2}").at(0);
+		} catch (json_exception e) {
+			error = e.msg;
+		}
+		assert(error == "Wrong json_view type for at");
+
+		try {
+			json_view("{\"a\": [1, 2, \"b\": 3}")["b"];
+		} catch (json_exception e) {
+			error = e.msg;
+		}
+		assert(error == "Expected '}', got EOF");
+	});
+
+	TEST("{\"user\": {\"id\": 7, \"name\": \"x\"}, \"entities\": {\"hashtags\": [{\"text\": \"a\", \"n\": 1}, {\"n\": 2}, {\"text\": [\"b\"]}]}, \"skip\": [[{\"text\": \"]\"}]]}", [](auto s) {
+		string text = s.str();
+		stringstream output;
+		output << json_parse(text, {"/user/id", "entities.hashtags.*.text", "/entities/hashtags/1/n", "/missing"});
+		assert(output.str() == "{\"user\":{\"id\":7},\"entities\":{\"hashtags\":[{\"text\":\"a\"},{\"n\":2},{\"text\":[\"b\"]}]}}");
+
+		stringstream whole, expected;
+		whole << json_parse(text, {""}) << json_parse(text, {"/skip/0"});
+		expected << json_parse(text) << "{\"skip\":[[{\"text\":\"]\"}]]}";
+		assert(whole.str() == expected.str());
+
+		size_t offset = 0;
+		try {
+			json_parse(text + " x", {"/user"});
+		} catch (json_parse_exception e) {
+			offset = e.offset;
+		}
+		assert(offset == text.size() + 1);
+
+		try {
+			json_parse("{\"a\": {\"b\": tru}}", {"/a/b"});
+		} catch (json_parse_exception e) {
+			offset = e.offset;
+		}
+		assert(offset == 15);
+	});
+
+	TEST("[1.23456789, 0.30000000000000004, 1e+300, -0, 9007199254740993, -42, 5e-324, {\"a\": [true, null, \"x\\\"\"]}]", [](auto s) {
+		string text = s.str();
+		json parsed = json_parse(text);
+		string dumped = json_dump(parsed);
+		assert(dumped == "[1.23456789,0.30000000000000004,1e+300,-0,9007199254740992,-42,5e-324,{\"a\":[true,null,\"x\\\"\"]}]");
+
+		stringstream output;
+		output << parsed;
+		string appended = "x";
+		json_dump_to(parsed, appended);
+		assert(output.str() == dumped && appended == "x" + dumped);
+
+		int fds[2];
+		assert(pipe(fds) == 0);
+		json_dump_to(parsed, fds[1]);
+		close(fds[1]);
+		char buffer[256];
+		ssize_t size = read(fds[0], buffer, sizeof(buffer));
+		close(fds[0]);
+		assert(string(buffer, size) == dumped);
+
+		json deep;
+		json* ptr = &deep;
+		for (int i = 0; i < 1000000; i++) {
+			ptr->set_list();
+			ptr = &json_emplace_back(*ptr);
+		}
+		string nested = json_dump(deep);
+		assert(nested.size() == 2000004 && nested.substr(999998, 8) == "[[null]]");
+	});
+
+	TEST("{\"k\\u00e9y\": \"tab\\there \\\"q\\\" \\\\ \\/ \\u20ac \\ud83d\\ude00 \\ud800\"}", [](auto s) {
+		json j = json_parse(s.str());
+		assert(j["k\u00e9y"].get_string() == "tab\there \"q\" \\ / \u20ac \U0001F600 \ufffd");
+		assert(json_dump(j) == "{\"k\u00e9y\":\"tab\\there \\\"q\\\" \\\\ / \u20ac \U0001F600 \ufffd\"}");
+		assert(json_dump(json_parse(string_view("[\"\\udc00\\ud83d\", \"\\ud83d\\u0041\"]"))) == "[\"\ufffd\ufffd\",\"\ufffdA\"]");
+
+		json text;
+		string raw = string(40, 'a') + "\"\x01" + string(33, 'b') + "\n\x1f\\" + string(5, 'c') + "\x7f\xc3\xa9";
+		text.set_string(raw);
+		string dumped = json_dump(text);
+		assert(dumped == "\"" + string(40, 'a') + "\\\"\\u0001" + string(33, 'b') + "\\n\\u001f\\\\" + string(5, 'c') + "\x7f\xc3\xa9\"");
+		assert(json_parse(dumped).get_string() == raw);
+
+		size_t offset = 0;
+		string msg;
+		try {
+			json_parse(string_view("[\"ab\\x\"]"));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+			offset = e.offset;
+		}
+		assert(msg == "Expected escape sequence, got byte 120" && offset == 6);
+
+		try {
+			json_parse(string_view("\"\\u12g4\""));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected hex digit, got byte 103");
+	});
+
+	TEST("{\"a\": [1, 2.5, true, null, \"x\\\"y\"], \"b\": {}, \"c\": [[]], \"d\": {\"e\": -0}}", [](auto s) {
+		json expected = json_parse(s.str());
+		string text = "x";
+		{
+			json_writer writer(text);
+			writer.begin_object();
+			writer.key("a");
+			writer.begin_array();
+			writer.value(1);
+			writer.value(2.5);
+			writer.value(true);
+			writer.value(nullptr);
+			writer.value("x\"y");
+			writer.end_array();
+			writer.key("b");
+			writer.begin_object();
+			writer.end_object();
+			writer.key("c");
+			writer.value(json_parse(string_view("[[]]")));
+			writer.key("d");
+			writer.value(json_parse(string_view("{\"e\": -0}")));
+			writer.end_object();
+			assert(writer.complete());
+		}
+		assert(text == "x" + json_dump(expected));
+
+		string msg;
+		json_writer broken(text);
+		broken.begin_object();
+		try {
+			broken.value(1);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Wrong json_writer state for value");
+		try {
+			broken.end_array();
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Wrong json_writer state for end_array");
+		broken.end_object();
+		try {
+			broken.begin_array();
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Wrong json_writer state for begin_array");
+
+		int fds[2];
+		assert(pipe(fds) == 0);
+		string streamed;
+		thread reader([&]() {
+			char buffer[4096];
+			ssize_t size;
+			while ((size = read(fds[0], buffer, sizeof(buffer))) > 0) {
+				streamed.append(buffer, size);
+			}
+		});
+		{
+			json_writer writer(fds[1]);
+			writer.begin_array();
+			for (int i = 0; i < 1000000; i++) {
+				writer.value(i);
+			}
+			writer.end_array();
+		}
+		close(fds[1]);
+		reader.join();
+		close(fds[0]);
+		json numbers = json_parse(streamed);
+		assert(streamed.size() == 6888891 && json_size(numbers) == 1000000 && json_at(numbers, 999999).get_number() == 999999);
+	});
+
+	TEST("{\"z\": [0, 23, 24, 255, 256, 65536, 4294967296, -1, -25, -0, 0.1, 1e300, 18446744073709551616, -9223372036854775808], \"k\\u00e9y\": {\"\": \"tab\\t\"}, \"e\": []}", [](auto s) {
+		json small = json_parse(string_view("{\"a\": [1, -1, 1.5, true, null, \"x\"]}"));
+		assert(json_to_binary(small) == string("\xa1\x61" "a\x86\x01\x20\xfa\x3f\xc0\x00\x00\xf5\xf6\x61x", 15));
+
+		json j = json_parse(s.str());
+		string data = json_to_binary(j);
+		assert(json_dump(json_from_binary(data)) == json_dump(j));
+
+		// Half floats and wide heads, which other encoders may produce
+		json half = json_from_binary(string("\x83\xf9\x3c\x00\xf9\x80\x01\x1b\x00\x00\x00\x00\x00\x00\x00\x05", 16));
+		assert(json_at(half, 0).get_number() == 1.0 && json_at(half, 1).get_number() == -std::ldexp(1.0, -24) && json_at(half, 2).get_number() == 5);
+
+		// Negative integers past 2^53 are rounded once
+		json large = json_parse(string_view("[-13755929021368454, -9007199254740993, -9223372036854775808]"));
+		assert(json_dump(json_from_binary(json_to_binary(large))) == json_dump(large));
+		assert(json_from_binary(string("\x3b\xff\xff\xff\xff\xff\xff\xff\xff", 9)).get_number() == -18446744073709551616.0);
+
+		string msg;
+		size_t offset = 0;
+		try {
+			json_from_binary(data.substr(0, data.size() - 1));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+			offset = e.offset;
+		}
+		assert(msg == "Expected CBOR item, got EOF" && offset == data.size() - 1);
+		try {
+			json_from_binary(string("\x82\x01\x9f\xff", 4));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+			offset = e.offset;
+		}
+		assert(msg == "Unsupported CBOR item, got byte 159" && offset == 2);
+		try {
+			json_from_binary(string("\xa1\x01\x02", 3));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+			offset = e.offset;
+		}
+		assert(msg == "Expected CBOR text key, got byte 1" && offset == 1);
+		try {
+			json_from_binary(string("\x9b\x00\x00\x00\x01\x00\x00\x00\x00\x01", 10));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected 4294967296 items, got EOF");
+		try {
+			json_from_binary(string("\xf6\xf6", 2));
+		} catch (json_parse_exception e) {
+			msg = e.msg;
+			offset = e.offset;
+		}
+		assert(msg == "Expected EOF, got byte 246" && offset == 1);
+
+		string path = "/tmp/json_load_binary_test.cbor";
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		json_to_binary(j, fd);
+		close(fd);
+		assert(json_dump(json_load_binary(path)) == json_dump(j));
+		remove(path.c_str());
+	});
+
+	TEST("{\"a\": [1, {\"b\": null}, [], \"x\\ty\"], \"c\": {\"d\": true, \"e\": -2.5}, \"f\": {}, \"g\": false}", [](auto s) {
+		json j = json_parse(s.str());
+		string data = json_to_tape(j);
+		json_tape tape(data.data(), data.size());
+		json_tape_view root = tape.root();
+		assert(root.is_dictionary() && root.size() == 4);
+		assert(root["a"].size() == 4 && root["a"].at(0).get_number() == 1 && root["a"].at(1)["b"].is_null());
+		assert(root["a"].at(2).is_list() && root["a"].at(2).begin_list() == root["a"].at(2).end_list());
+		string_view text = root["a"].at(3).get_string();
+		assert(text == "x\ty" && text.data() > data.data() && text.data() < data.data() + data.size());
+		assert(root["c"]["d"].get_bool() && root["c"]["e"].get_number() == -2.5 && !root["g"].get_bool());
+		assert(json_dump(root.to_json()) == json_dump(j) && json_dump(root["c"].to_json()) == "{\"d\":true,\"e\":-2.5}");
+
+		string keys;
+		for (auto it = root.begin_dictionary(); it != root.end_dictionary(); ++it) {
+			keys += it->first;
+		}
+		assert(keys == "acfg");
+		size_t count = 0;
+		for (auto it = root["a"].begin_list(); it != root["a"].end_list(); it++) {
+			count += it->is_number() ? it->get_number() : 10;
+		}
+		assert(count == 31);
+
+		string msg;
+		try {
+			root["a"].at(4);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Index 4 out of range for json_tape_view");
+		try {
+			root["z"];
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Unable to find key 'z' for json_tape_view");
+		try {
+			root["g"].get_number();
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Wrong json_tape_view type for get_number");
+		try {
+			json_tape broken(data.data(), data.size() - 1);
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected json tape of " + to_string(data.size()) + " bytes, got " + to_string(data.size() - 1));
+		try {
+			json_tape broken(s.str().data(), s.str().size());
+		} catch (json_exception e) {
+			msg = e.msg;
+		}
+		assert(msg == "Expected json tape header");
+
+		// The text of repeated keys is stored once
+		json records;
+		records.set_list();
+		for (int i = 0; i < 1000; i++) {
+			json& record = json_emplace_back(records);
+			record.set_dictionary();
+			record["name"].set_number(i);
+		}
+		string path = "/tmp/json_tape_test.tape";
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		json_to_tape(records, fd);
+		close(fd);
+		json_tape mapped(path);
+		assert(json_to_tape(records).size() == 16 + 3001 * 16 + 4);
+		assert(mapped.root().size() == 1000 && mapped.root().at(999)["name"].get_number() == 999);
+		remove(path.c_str());
+	});
+
 	TEST_OSTREAM("null");
 	TEST_OSTREAM("false");
 	TEST_OSTREAM("\"hello\"");
@@ -377,13 +1422,13 @@ int main(int argc, char** argv) {
 	// - https://huggingface.co/datasets/enryu43/twitter100m_tweets
 	// - and others from https://www.reddit.com/r/datasets/ and https://www.reddit.com/r/opendata/
 	for (int i = 1; i < argc; i++) {
-		ifstream stream(argv[i]);
-
 		try {
-			json j;
-			stream >> j;
+			json j = json_load_file(argv[i]);
 			cout << "TEST:" << argv[i] << ": Passed" << endl;
-		} catch (json_exception e) {
+		} catch (json_parse_exception e) {
+			ifstream stream(argv[i]);
+			stream.seekg(e.offset);
+
 			cout << "TEST:" << argv[i] << ": " << e.msg << " before '";
 			for (size_t j = 0; j < 50 && stream; j++) {
 				char symbol = stream.get();
@@ -391,6 +1436,9 @@ int main(int argc, char** argv) {
 			}
 			cout << "'" << endl;
 			break;
+		} catch (json_exception e) {
+			cout << "TEST:" << argv[i] << ": " << e.msg << endl;
+			break;
 		}
 	}
 }